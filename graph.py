@@ -11,9 +11,21 @@ def to_datetime(timestamp):
     return datetime.fromtimestamp(timestamp / 1000.0)
 
 # Load data from JSON files
+# Prices and volumes are stored as integer ticks, the "scale" of a file gives the ticks per unit.
+# Files written before the scale was introduced hold decimal values.
+PRICE_KEYS = ('p', 'open', 'close', 'high', 'low')
+
 def load_json(filename):
     with open(filename, 'r') as file:
-        return json.load(file)['data']
+        content = json.load(file)
+    scale = content.get('scale', {'p': 1, 'v': 1})
+    for record in content['data']:
+        for key in PRICE_KEYS:
+            if key in record:
+                record[key] = record[key] / scale['p']
+        if 'v' in record:
+            record['v'] = record['v'] / scale['v']
+    return content['data']
 
 symbol = '../AAPL'
 
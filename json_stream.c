@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "json_stream.h"
+
+// Open a file for streaming
+int json_stream_open(JsonStream *stream, const char *path) {
+    memset(stream, 0, offsetof(JsonStream, object));
+    stream->object[0] = '\0';
+    stream->object_len = 0;
+    stream->skipped = 0;
+    stream->file = fopen(path, "r");
+    if (!stream->file) return -1;
+    return 0;
+}
+
+// Close the underlying file
+void json_stream_close(JsonStream *stream) {
+    if (stream->file) fclose(stream->file);
+    stream->file = NULL;
+}
+
+// Append a character to the record that is being captured
+static void capture_char(JsonStream *stream, char c) {
+    if (stream->object_len < JSON_STREAM_MAX_OBJECT) {
+        stream->object[stream->object_len++] = c;
+    } else {
+        stream->overflow = 1;
+    }
+}
+
+// Advance to the next record of the data array
+int json_stream_next(JsonStream *stream) {
+    while (!stream->done) {
+        if (stream->pos == stream->len) {
+            stream->len = fread(stream->buf, 1, sizeof(stream->buf), stream->file);
+            stream->pos = 0;
+            if (stream->len == 0) return ferror(stream->file) ? -1 : 0;
+        }
+        char c = stream->buf[stream->pos++];
+
+        if (stream->capturing) capture_char(stream, c);
+        if (stream->in_scale && stream->header_len < sizeof(stream->header) - 1) {
+            stream->header[stream->header_len++] = c;
+        }
+
+        if (stream->in_string) {
+            if (stream->escape) {
+                stream->escape = 0;
+            } else if (c == '\\') {
+                stream->escape = 1;
+            } else if (c == '"') {
+                stream->in_string = 0;
+                if (stream->depth == 1 && !stream->in_data) {
+                    stream->data_key = (stream->key_len == 4 && memcmp(stream->key, "data", 4) == 0);
+                    stream->scale_key = (stream->key_len == 5 && memcmp(stream->key, "scale", 5) == 0);
+                }
+            } else if (stream->depth == 1 && !stream->in_data && stream->key_len < sizeof(stream->key)) {
+                stream->key[stream->key_len++] = c;
+            }
+            continue;
+        }
+
+        switch (c) {
+            case '"':
+                stream->in_string = 1;
+                stream->key_len = 0;
+                break;
+            case ':':
+                if (stream->data_key == 1) stream->data_key = 2;
+                if (stream->scale_key == 1) stream->scale_key = 2;
+                break;
+            case '{':
+            case '[':
+                stream->depth++;
+                if (stream->depth == 2 && c == '[' && stream->data_key == 2) {
+                    stream->in_data = 1;
+                } else if (stream->depth == 2 && c == '{' && stream->scale_key == 2) {
+                    stream->in_scale = 1;
+                    stream->header[0] = c;
+                    stream->header_len = 1;
+                } else if (stream->in_data && stream->depth == 3 && c == '{') {
+                    // Start of a record, capture it including the opening brace
+                    stream->capturing = 1;
+                    stream->overflow = 0;
+                    stream->object_len = 0;
+                    capture_char(stream, c);
+                }
+                stream->data_key = 0;
+                stream->scale_key = 0;
+                break;
+            case '}':
+            case ']':
+                stream->depth--;
+                if (stream->in_scale && stream->depth == 1) {
+                    stream->in_scale = 0;
+                    stream->header[stream->header_len] = '\0';
+                    json_stream_get_ll(stream->header, stream->header_len, "p", &stream->price_scale);
+                    json_stream_get_ll(stream->header, stream->header_len, "v", &stream->volume_scale);
+                }
+                if (stream->capturing && stream->depth == 2) {
+                    stream->capturing = 0;
+                    if (stream->overflow) {
+                        stream->skipped++;
+                        break;
+                    }
+                    stream->object[stream->object_len] = '\0';
+                    return 1;
+                }
+                if (stream->in_data && stream->depth == 1) stream->done = 1;
+                break;
+            case ' ':
+            case '\t':
+            case '\r':
+            case '\n':
+                break;
+            default:
+                if (stream->data_key != 2) stream->data_key = 0;
+                if (stream->scale_key != 2) stream->scale_key = 0;
+                break;
+        }
+    }
+    return 0;
+}
+
+// Find the value of a top level key inside a flat record, returns a pointer to its first character
+static const char *find_value(const char *object, size_t len, const char *key) {
+    size_t key_len = strlen(key);
+    int depth = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = object[i];
+        if (c == '{' || c == '[') {
+            depth++;
+        } else if (c == '}' || c == ']') {
+            depth--;
+        } else if (c == '"') {
+            size_t start = ++i;
+            while (i < len && object[i] != '"') {
+                if (object[i] == '\\') i++;
+                i++;
+            }
+            if (depth != 1) continue;
+            size_t j = i + 1;
+            while (j < len && (object[j] == ' ' || object[j] == '\t' || object[j] == '\n' || object[j] == '\r')) j++;
+            if (j >= len || object[j] != ':') continue; // a string value, not a key
+            if (i - start == key_len && memcmp(object + start, key, key_len) == 0) {
+                j++;
+                while (j < len && (object[j] == ' ' || object[j] == '\t' || object[j] == '\n' || object[j] == '\r')) j++;
+                return j < len ? object + j : NULL;
+            }
+            i = j;
+        }
+    }
+    return NULL;
+}
+
+// Read an integer field
+int json_stream_get_ll(const char *object, size_t len, const char *key, long long *out) {
+    const char *value = find_value(object, len, key);
+    if (!value) return -1;
+    char *end;
+    long long result = strtoll(value, &end, 10);
+    if (end == value) return -1;
+    // Values written as reals (e.g. 1.7e12) are still accepted
+    if (*end == '.' || *end == 'e' || *end == 'E') result = (long long)strtod(value, &end);
+    *out = result;
+    return 0;
+}
+
+// Read a number field
+int json_stream_get_double(const char *object, size_t len, const char *key, double *out) {
+    const char *value = find_value(object, len, key);
+    if (!value) return -1;
+    char *end;
+    double result = strtod(value, &end);
+    if (end == value) return -1;
+    *out = result;
+    return 0;
+}
+
+// Read a string field, escape sequences are copied verbatim
+int json_stream_get_string(const char *object, size_t len, const char *key, char *out, size_t out_size) {
+    const char *value = find_value(object, len, key);
+    if (!value || *value != '"' || out_size == 0) return -1;
+    const char *end = object + len;
+    size_t n = 0;
+    for (value++; value < end && *value != '"'; value++) {
+        if (*value == '\\' && value + 1 < end) value++;
+        if (n + 1 < out_size) out[n++] = *value;
+    }
+    out[n] = '\0';
+    return 0;
+}
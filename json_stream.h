@@ -0,0 +1,55 @@
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Size of the read buffer and the largest single record that can be returned
+#define JSON_STREAM_BUF_SIZE 65536
+#define JSON_STREAM_MAX_OBJECT 4096
+
+// Streaming reader for the {"type": ..., "data": [ {...}, {...} ]} files written by rtes.
+// Only one record of the data array is held in memory at a time, so memory use does not
+// depend on the size of the file.
+typedef struct {
+    FILE *file;
+    char buf[JSON_STREAM_BUF_SIZE];
+    size_t pos, len;
+    int depth;          // nesting depth of the scanner
+    int in_string;      // scanner is inside a string literal
+    int escape;         // previous character was a backslash
+    int in_data;        // scanner has entered the data array
+    int done;           // data array has been closed
+    char key[8];        // last top level string seen, used to find the "data" key
+    size_t key_len;
+    int data_key;       // 1 after the "data" string, 2 after its colon
+    int scale_key;      // same for the "scale" string
+    int in_scale;       // the scale object is being copied into header
+    char header[64];
+    size_t header_len;
+    long long price_scale;  // ticks per unit from the "scale" header, 0 for files with decimal values
+    long long volume_scale;
+    int capturing;      // a record is being copied into object
+    int overflow;       // the current record does not fit into object
+    char object[JSON_STREAM_MAX_OBJECT + 1]; // current record, NUL-terminated
+    size_t object_len;
+    long long skipped;  // records that were too large and had to be skipped
+} JsonStream;
+
+// Open a file for streaming. Returns 0 on success and -1 if the file can not be opened.
+int json_stream_open(JsonStream *stream, const char *path);
+
+// Advance to the next record of the data array. The header before the array has been read once
+// the first record is returned, so price_scale and volume_scale are known by then.
+// Returns 1 when stream->object holds a record, 0 at the end of the array and -1 on a read error.
+int json_stream_next(JsonStream *stream);
+
+// Close the underlying file
+void json_stream_close(JsonStream *stream);
+
+// Read a top level field of a flat record. Return 0 if the key was found and parsed, -1 otherwise.
+int json_stream_get_ll(const char *object, size_t len, const char *key, long long *out);
+int json_stream_get_double(const char *object, size_t len, const char *key, double *out);
+int json_stream_get_string(const char *object, size_t len, const char *key, char *out, size_t out_size);
+
+#endif
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -7,97 +8,294 @@
 #include <pthread.h>
 #include <jansson.h>
 #include <time.h>
-
-//Number of threads which is also the number of symbols
-#define NUM_THREADS 3 // the maximum number of trades that can be handled at once
-#define NUM_SYMBOLS 3
-#define BUFFER_SIZE 1024
-
-// Global mutex
-pthread_mutex_t mutex;
+#include <getopt.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include "rtes.h"
+#include "rtes_metrics.h"
+#include "rtes_feed.h"
+#include "rtes_retention.h"
+#include "rtes_alert.h"
 
 // Websocket state flags
-static int destroy_flag = 0; // destroy flag
 static int connection_flag = 0; // connection flag
 static int writeable_flag = 0; // writeable flag
 
-// This function sets the destroy flag to 1 when the SIGINT signal (Ctr+C) is received
-// This is used to close the websocket connection and free the memory
+// permessage-deflate, off unless --deflate is given. The window bits are offered for both
+// directions: the server's window bounds the memory of our inflater (2^bits bytes), the memory
+// level sets the size of the compressor state for the messages we send.
+static int deflate_enabled = 0;
+static int deflate_window = 15;
+static int deflate_mem_level = 8;
+static char deflate_offer[128];
+
+static const struct lws_extension extensions[] = {
+    {"permessage-deflate", lws_extension_callback_pm_deflate, deflate_offer},
+    {NULL, NULL, NULL}
+};
+
+// Wire accounting of the current connection: TCP bytes already counted, and CPU time the
+// receive callback spent parsing during the current lws_service call
+static long long wire_counted = 0;
+static long long parse_cpu_us = 0;
+
+// Recording of the received messages for --replay, set with --record
+static FILE *record_file = NULL;
+
+// A message that lws delivers in fragments, collected in the connection's user data. The buffer
+// grows in place and is kept for the next message; a message that arrives in one piece is parsed
+// where lws put it.
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t cap;
+    long long first_us;     // receive time of the first fragment
+    int fragments;
+    int oversize;           // the message is larger than max_message and is skipped
+} MessageBuffer;
+
+static size_t max_message = 4 << 20; // --max-message, bytes
+
+// Alert rules checked on every trade and candlestick, and where fired alerts are written
+static const char *alert_rules = NULL;
+static const char *alert_out = NULL;
+
+// Liveness of the connection. A websocket ping is sent every ping_interval ms and its round trip
+// is recorded. A connection that leaves a ping unanswered for stall_timeout ms, or that delivers
+// no trades for stall_timeout ms while the market is open, is closed and reconnected in-process,
+// instead of waiting minutes for TCP to notice a half-open connection.
+static long long ping_interval = 5000;
+static long long stall_timeout = 15000;
+static int market_open_min = 9 * 60 + 30;   // market hours in New York time, minutes after midnight
+static int market_close_min = 16 * 60;
+static int market_always = 0;               // --market-hours always, e.g. for replays or testing
+static long long ping_sent_us = 0;          // send time of the unanswered ping, 0 if none
+static long long last_ping_ms = 0;
+static int ping_due = 0;                    // a ping waits for the socket to become writeable
+static int subscribed = 0;                  // symbols subscribed to on this connection
+static long long last_data_ms = 0;          // last trade, or when the connection or the market opened
+static long long stall_limit = 0;           // doubled after every stall without trades, e.g. on holidays
+static int reconnect_flag = 0;              // the connection was closed by the stall detector
+static Histogram ping_rtt;
+
+// Count the bytes received on the connection's socket since the last call
+static void count_wire_bytes(struct lws *wsi) {
+    long long received = rt_socket_bytes_received(lws_get_socket_fd(wsi));
+    if (received > wire_counted) {
+        metrics_add(METRIC_WIRE_BYTES, received - wire_counted);
+        wire_counted = received;
+    }
+}
+
+// Whether the market is open at now_ms: weekdays between --market-hours in New York time, with
+// the US daylight saving rules. Exchange holidays are not known, the stall limit backs off instead.
+static long long dst_switch(int year, int month, int sunday, int hour_utc) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = year - 1900;
+    tm.tm_mon = month;
+    tm.tm_mday = 1;
+    time_t first = timegm(&tm);
+    gmtime_r(&first, &tm);
+    int day = (7 - tm.tm_wday) % 7 + 7 * (sunday - 1);
+    return (long long)first + day * 86400LL + hour_utc * 3600LL;
+}
+
+static int market_open(long long now_ms) {
+    if (market_always) return 1;
+    time_t utc = now_ms / 1000;
+    struct tm tm;
+    gmtime_r(&utc, &tm);
+    // Daylight saving time runs from 2:00 on the second Sunday of March to 2:00 on the first Sunday of November
+    int dst = utc >= dst_switch(tm.tm_year + 1900, 2, 2, 7) && utc < dst_switch(tm.tm_year + 1900, 10, 1, 6);
+    time_t local = utc - (dst ? 4 : 5) * 3600;
+    gmtime_r(&local, &tm);
+    if (tm.tm_wday == 0 || tm.tm_wday == 6) return 0;
+    int minute = tm.tm_hour * 60 + tm.tm_min;
+    return minute >= market_open_min && minute < market_close_min;
+}
+
+// Request a ping when one is due, and close the connection when it stalled
+static void check_liveness(struct lws *wsi) {
+    static int was_open = 0;
+    long long now = current_time_ms();
+    int open = market_open(now);
+    // Trades are only expected from the opening bell on
+    if (open && !was_open) last_data_ms = now;
+    was_open = open;
+    if (!connection_flag || reconnect_flag || wsi == NULL) return;
+
+    if (stall_timeout > 0) {
+        const char *reason = NULL;
+        long long silent = 0;
+        if (ping_sent_us && rt_now_us() - ping_sent_us > stall_timeout * 1000) {
+            reason = "Ping unanswered";
+            silent = (rt_now_us() - ping_sent_us) / 1000;
+        } else if (open && now - last_data_ms > stall_limit) {
+            reason = "No trades";
+            silent = now - last_data_ms;
+            // The market may be quiet or closed for a holiday, wait longer before the next attempt
+            stall_limit = stall_limit * 2 < 10 * 60 * 1000 ? stall_limit * 2 : 10 * 60 * 1000;
+        }
+        if (reason) {
+            printf("[Liveness] %s for %lld ms, reconnecting.\n", reason, silent);
+            metrics_add(METRIC_STALLS, 1);
+            reconnect_flag = 1;
+            lws_set_timeout(wsi, PENDING_TIMEOUT_USER_OK, LWS_TO_KILL_ASYNC);
+            return;
+        }
+    }
+    if (ping_interval > 0 && !ping_sent_us && !ping_due && now - last_ping_ms >= ping_interval) {
+        ping_due = 1;
+        lws_callback_on_writable(wsi);
+    }
+}
+
+// Send a ping carrying its send time, the pong echoes it back
+static void send_ping(struct lws *wsi) {
+    static unsigned char out[LWS_SEND_BUFFER_PRE_PADDING + sizeof(long long) + LWS_SEND_BUFFER_POST_PADDING];
+    long long sent = rt_now_us();
+    memcpy(out + LWS_SEND_BUFFER_PRE_PADDING, &sent, sizeof(sent));
+    if (lws_write(wsi, out + LWS_SEND_BUFFER_PRE_PADDING, sizeof(sent), LWS_WRITE_PING) == (int)sizeof(sent)) {
+        ping_sent_us = sent;
+    }
+    last_ping_ms = current_time_ms();
+    ping_due = 0;
+}
+
+// Signals received and the monotonic time of the first one
+static volatile sig_atomic_t signals_received = 0;
+static long long stop_requested_us = 0;
+
+// This function sets the destroy flag to 1 when SIGINT (Ctrl+C) or SIGTERM is received, the main
+// loop then stops taking frames and drains the pipeline (see drain_pipeline). Only async-signal-safe
+// calls are made here. A second signal exits at once, the next start repairs the data files.
 static void interrupt_handler(int signal) {
+    static const char stopping[] = "[Main] Stopping, send the signal again to exit without draining.\n";
+    static const char forced[] = "[Main] Exiting without draining.\n";
+    if (signals_received++) {
+        if (write(STDOUT_FILENO, forced, sizeof(forced) - 1) < 0) {}
+        _exit(1);
+    }
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    stop_requested_us = ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
     destroy_flag = 1;
-    printf("[Main] Program terminated.\n");
+    if (write(STDOUT_FILENO, stopping, sizeof(stopping) - 1) < 0) {}
 }
 
-// FUnction for the current time
-long long current_time_ms() {
-    struct timeval time_now;
-    gettimeofday(&time_now, NULL);
-    return (time_now.tv_sec * 1000LL + time_now.tv_usec / 1000); // current time in ms
+// The producer, aggregation, metrics and retention threads
+pthread_t producers[NUM_THREADS], aggregators[MAX_AGG_WORKERS], metrics_writer, retention;
+
+// Join a thread, giving up at the deadline (monotonic, in us). Returns 0 when it was joined.
+static int join_by(pthread_t thread, long long deadline) {
+    long long left = deadline - rt_now_us();
+    if (left < 0) left = 0;
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += left / 1000000;
+    ts.tv_nsec += (left % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return pthread_timedjoin_np(thread, NULL, &ts);
 }
 
-// Structure to hold symbol-specific file paths
-typedef struct {
-	char symbol[BUFFER_SIZE];
-    char trade_file[BUFFER_SIZE];
-    char cand_file[BUFFER_SIZE];
-    char mov_file[BUFFER_SIZE];
-	float price;
-	long long timestamp;
-	float volume;
-} SymbolData;
+// Orderly shutdown once the main loop has stopped taking frames. The producers store every queued
+// trade, the aggregation workers finalize the windows that are ready, and the data files are synced and
+// recorded in a checkpoint. All of it has to finish within config.shutdown_timeout ms of the stop
+// request; a phase that is still running then is abandoned and no checkpoint is written.
+// Returns 0 when the pipeline was drained in time.
+static int drain_pipeline(int retaining) {
+    long long start = stop_requested_us ? stop_requested_us : rt_now_us();
+    long long deadline = start + config.shutdown_timeout * 1000LL;
+    const char *failed = NULL;
+
+    // Intake: the merge hands on the trades it holds, a retention pass stops after the symbol at hand
+    feeds_stop();
+    if (retaining && join_by(retention, deadline) != 0) {
+        fprintf(stderr, "[Shutdown] The retention pass did not stop in time, leaving it behind\n");
+    }
+    long long intake = rt_now_us();
+
+    // Drain: the producers store the queued trades and exit
+    size_t queued, high_water;
+    unsigned long long dropped;
+    trade_queue_stats(&queued, &high_water, &dropped);
+    for (int i = 0; i < NUM_THREADS; i++) queue_close(&trade_queues[i]);
+    for (int i = 0; i < NUM_THREADS && !failed; i++) {
+        if (join_by(producers[i], deadline) != 0) failed = "draining the trade queues";
+    }
+    long long drain = rt_now_us();
 
-typedef struct {
-	int id;
-	float price;
-	long long timestamp;
-	float volume;
-} TradeData;
-
-// An array of SymbolData and the producer consumer threads
-SymbolData symbols[NUM_SYMBOLS];
-pthread_t producers[NUM_THREADS], consumers[NUM_SYMBOLS];
-
-// Initialize JSON files for each symbol
-void initialize_json(const char* symbol, SymbolData* data);
-
-// Add trade sample to the JSON file (Producer)
-void add_trade_sample(const char* file_path, double price, const char* symbol, long long timestamp, double volume);
-
-// Process trades (Consumer)
-int process_trades(const char *trade_file, const char *cand_file, const char *mov_file);
-
-// FUnction for the current time
-long long current_time_ms();
-
-// Producer thread function
-void* producer_thread(void* arg) {
-    pthread_mutex_lock(&mutex);
-    TradeData* data = (TradeData*)arg;
-    const char* trade_file = symbols[data->id].trade_file;
-    const char* symbol = symbols[data->id].symbol;
-    add_trade_sample(trade_file, data->price, symbol, data->timestamp, data->volume);
-	free(data);  // Free the dynamically allocated memory
-	pthread_mutex_unlock(&mutex);
-	printf("[%s producer] Added trade to %s\n", symbol, trade_file);
-    
-    return NULL;
+    // Flush: the aggregation workers finalize the windows that are ready and exit
+    drained_flag = 1;
+    agg_workers_wake();
+    for (int i = 0; i < config.agg_workers && !failed; i++) {
+        if (join_by(aggregators[i], deadline) != 0) failed = "finalizing the candlesticks";
+    }
+    long long flush = rt_now_us();
+
+    // Checkpoint: nothing appends to the data files any more
+    if (!failed && checkpoint_write(CHECKPOINT_FILE, current_time_ms()) != 0) {
+        fprintf(stderr, "[Shutdown] Could not write the checkpoint\n");
+    }
+    long long end = rt_now_us();
+    if (!failed && end > deadline) failed = "writing the checkpoint";
+
+    printf("[Shutdown] intake=%lld ms, drain=%lld ms (%zu queued trades), flush=%lld ms, checkpoint=%lld ms, "
+           "total=%lld ms of %d ms\n", (intake - start) / 1000, (drain - intake) / 1000, queued,
+           (flush - drain) / 1000, (end - flush) / 1000, (end - start) / 1000, config.shutdown_timeout);
+    if (failed) {
+        size_t left;
+        trade_queue_stats(&left, &high_water, &dropped);
+        fprintf(stderr, "[Shutdown] The deadline passed while %s, %zu trades were not stored\n", failed, left);
+        return -1;
+    }
+    return 0;
+}
+
+// Trades the producers' dedup sets had to forget early because they were full
+static unsigned long long dedup_evictions() {
+    unsigned long long evictions = 0;
+    for (int i = 0; i < NUM_THREADS; i++) evictions += __atomic_load_n(&dedup_sets[i].evictions, __ATOMIC_RELAXED);
+    return evictions;
 }
 
-// Consumer thread function
-void* consumer_thread(void* arg) {
-	int id = *(int*)arg;
-	free(arg);
-	while(!destroy_flag) {
-		sleep(60);
-		pthread_mutex_lock(&mutex);
-		int index_1 = process_trades(symbols[id].trade_file, symbols[id].cand_file, symbols[id].mov_file);
-		pthread_mutex_unlock(&mutex);
-		printf("[%s consumer] Processed %d trades\n", symbols[id].symbol, index_1);
+// Metrics thread function
+// Rewrites the Prometheus text file periodically. The hot path only bumps per-thread counters,
+// gauges are sampled here.
+void* metrics_thread(void* arg) {
+    (void)arg;
+    while (!destroy_flag) {
+        sleep(config.metrics_interval);
+
+        size_t depth, high_water;
+        unsigned long long dropped;
+        trade_queue_stats(&depth, &high_water, &dropped);
+        MetricsGauge gauges[] = {
+            {"rtes_queue_depth", "Trades waiting for the producers", depth},
+            {"rtes_queue_high_water", "Most trades that were waiting for one producer at once", high_water},
+            {"rtes_connected", "Whether the websocket is connected", connection_flag},
+            {"rtes_arena_overflows", "Parser allocations that did not fit into the arena of their feed", feeds_arena_overflows()},
+            {"rtes_dedup_evictions", "Trades forgotten by the dedup sets before their window ended", dedup_evictions()},
+        };
+        MetricsHistogram hists[] = {
+            {"rtes_receive_to_process_us", "Time from receiving a frame until its trade is stored and aggregated", &process_latency},
+            {"rtes_candle_emit_lag_ms", "Time from the end of a window until its candlestick is written", &emit_lag},
+            {"rtes_ping_rtt_us", "Round trip time of websocket pings", &ping_rtt},
+            {"rtes_trade_to_alert_us", "Time from receiving a trade until the alert it fired is written", &alert_latency},
+        };
+        if (metrics_write_file(config.metrics_file, gauges, sizeof(gauges) / sizeof(gauges[0]),
+                               hists, sizeof(hists) / sizeof(hists[0])) != 0) {
+            fprintf(stderr, "[Metrics] Could not write %s\n", config.metrics_file);
+        }
     }
     return NULL;
 }
 
-// This function sends a message to the websocket
+// This function sends the subscribe message of the next symbol to the websocket
 static void websocket_write_back(struct lws *wsi) {
 	//Check if the websocket instance is NULL
     if (wsi == NULL){
@@ -105,33 +303,70 @@ static void websocket_write_back(struct lws *wsi) {
         return;
     }
 
-    char *out = NULL;
-    char str[BUFFER_SIZE + 34];
-	
-	pthread_mutex_lock(&mutex);
-    for(int i = 0; i < NUM_SYMBOLS; i++){
-        snprintf(str, sizeof(str), "{\"type\":\"subscribe\",\"symbol\":\"%s\"}\n", symbols[i].symbol);
-        //Printing the subscription request
-        printf("Websocket write back: %s\n", str);
-        int len = strlen(str);
-        out = (char *)malloc(sizeof(char)*(LWS_SEND_BUFFER_PRE_PADDING + len + LWS_SEND_BUFFER_POST_PADDING));
-        memcpy(out + LWS_SEND_BUFFER_PRE_PADDING, str, len);
-        lws_write(wsi, (unsigned char *) (out+LWS_SEND_BUFFER_PRE_PADDING), len, LWS_WRITE_TEXT);
-    }
-    pthread_mutex_unlock(&mutex);
-    
-    //Free the memory
-    free(out);
+    // One send buffer with room for the padding lws needs in front of the payload, reused for every message
+    static unsigned char out[LWS_SEND_BUFFER_PRE_PADDING + BUFFER_SIZE + 34 + LWS_SEND_BUFFER_POST_PADDING];
+    char *str = (char *)out + LWS_SEND_BUFFER_PRE_PADDING;
+
+    int len = snprintf(str, BUFFER_SIZE + 34, "{\"type\":\"subscribe\",\"symbol\":\"%s\"}\n", symbol_info[subscribed].symbol);
+    //Printing the subscription request
+    printf("Websocket write back: %s\n", str);
+    if (lws_write(wsi, out + LWS_SEND_BUFFER_PRE_PADDING, len, LWS_WRITE_TEXT) < 0) {
+        printf("[Websocket write back] Could not subscribe to %s.\n", symbol_info[subscribed].symbol);
+        return;
+    }
+    subscribed++;
 }
 
 static int ws_callback_echo(struct lws *wsi, enum lws_callback_reasons reason, void *user, void *in, size_t len);
 
+// Hand a complete message to the parser and queue its trades
+static void receive_message(const char *in, size_t len, long long recv_us) {
+    if (!config.quiet) printf("[Main Service] The Client received a message:%.*s\n", (int)len, in);
+    if (record_file) feed_record(record_file, in, len);
+    if (handle_frame(FEED_WEBSOCKET, in, len, recv_us) > 0) {
+        last_data_ms = current_time_ms();
+        stall_limit = stall_timeout;
+    }
+}
+
+// Append a fragment to the message being collected. The buffer is grown once for what lws says
+// is left of the current frame, doubling so a message is copied a bounded number of times.
+// Returns -1 while the message is skipped because it exceeds max_message.
+static int message_add(MessageBuffer *message, struct lws *wsi, const void *in, size_t len, long long recv_us) {
+    if (message->fragments++ == 0) message->first_us = recv_us;
+    if (message->oversize) return -1;
+    size_t need = message->len + len;
+    if (need > max_message) {
+        message->oversize = 1;
+        metrics_add(METRIC_OVERSIZE_MESSAGES, 1);
+        fprintf(stderr, "[Main Service] Skipping a message of more than %zu bytes\n", max_message);
+        return -1;
+    }
+    if (need > message->cap) {
+        size_t cap = message->cap ? message->cap : 4096;
+        size_t want = need + lws_remaining_packet_payload(wsi);
+        while (cap < want) cap *= 2;
+        if (cap > max_message) cap = max_message;
+        char *buf = realloc(message->buf, cap);
+        if (!buf) {
+            message->oversize = 1;
+            metrics_add(METRIC_OVERSIZE_MESSAGES, 1);
+            return -1;
+        }
+        message->buf = buf;
+        message->cap = cap;
+    }
+    memcpy(message->buf + message->len, in, len);
+    message->len = need;
+    return 0;
+}
+
 // Protocols used for the websocket
 static struct lws_protocols protocols[] = {
     {
         "example", //name
         ws_callback_echo, //callback function
-        0, // user data size
+        sizeof(MessageBuffer), // user data size
         0, // receive buffer size
     },
     { NULL, NULL, 0, 0 } // terminator
@@ -145,95 +380,99 @@ static int ws_callback_echo(struct lws *wsi, enum lws_callback_reasons reason, v
     		printf("[Main Service] Successful Client Connection.\n");
             //Set flags
             connection_flag = 1;
+            reconnect_flag = 0;
+            ping_sent_us = 0;
+            ping_due = 0;
+            subscribed = 0;
+            last_ping_ms = last_data_ms = current_time_ms();
+            // Count the handshake of the new connection as well
+            wire_counted = 0;
+            count_wire_bytes(wsi);
+            if (deflate_enabled) {
+                char level[8];
+                snprintf(level, sizeof(level), "%d", deflate_mem_level);
+                lws_set_extension_option(wsi, "permessage-deflate", "mem_level", level);
+            }
             break;
         //This case is called when there is an error in the connection
         case LWS_CALLBACK_CLIENT_CONNECTION_ERROR:
             printf("[Main Service] Client Connection Error: %s.\n", (char *)in);
-            //Set flags
-            destroy_flag = 1;
+            metrics_add(METRIC_RECONNECTS, 1);
+            //Set flags, a reconnect of the stall detector is retried in-process
+            if (!reconnect_flag) destroy_flag = 1;
             connection_flag = 0;
             break;
         //This case is called when the client receives a message from the websocket
-        case LWS_CALLBACK_CLIENT_RECEIVE:
-            printf("[Main Service] The Client received a message:%s\n", (char *)in);
-            
-            // Parse the received message
-            json_t *root;
-            json_error_t error;
-            root = json_loads((char *)in, 0, &error);
-            if (!root) {
-                printf("Error: on line %d: %s\n", error.line, error.text);
-                break;
+        case LWS_CALLBACK_CLIENT_RECEIVE: {
+            long long recv_us = rt_now_us();
+            long long cpu = rt_thread_cpu_us();
+            count_wire_bytes(wsi);
+            metrics_add(METRIC_DECODED_BYTES, len);
+            MessageBuffer *message = user;
+            // The message ends with the payload of its final frame
+            int last = lws_is_final_fragment(wsi) && lws_remaining_packet_payload(wsi) == 0;
+            if (last && message->fragments == 0) {
+                if (len <= max_message) receive_message((const char *)in, len, recv_us);
+                else message_add(message, wsi, in, len, recv_us); // counted and skipped
+            } else if (message_add(message, wsi, in, len, recv_us) == 0 && last) {
+                metrics_add(METRIC_FRAGMENTED_MESSAGES, 1);
+                metrics_add(METRIC_MESSAGE_FRAGMENTS, message->fragments);
+                receive_message(message->buf, message->len, message->first_us);
             }
-			
-			json_t *type = json_object_get(root, "type");
-			if (type && json_is_string(type)) {
-				const char *type_str = json_string_value(type);
-				if (strcmp(type_str, "ping") == 0) {
-					json_decref(root);
-					break;
-				}
-			}
-			
-            json_t *data = json_object_get(root, "data");
-            if (!json_is_array(data)) {
-                json_decref(root);
-                break;
+            if (last) {
+                message->len = 0;
+                message->fragments = 0;
+                message->oversize = 0;
             }
+            parse_cpu_us += rt_thread_cpu_us() - cpu;
+            break;
+        }
 
-            size_t index;
-            json_t *value;
-            int tid = 0;
-            json_array_foreach(data, index, value) {
-                const char *symbol = json_string_value(json_object_get(value, "s"));
-                double price = json_number_value(json_object_get(value, "p"));
-                double volume = json_number_value(json_object_get(value, "v"));
-                long long timestamp = json_integer_value(json_object_get(value, "t"));
-                for (int i = 0; i < NUM_SYMBOLS; i++) {
-                    if (strcmp(symbols[i].symbol, symbol) == 0) {
-                    	// Make a dynamically allocated copy of the data to avoid overriding
-						TradeData* temp = malloc(sizeof(TradeData));  // Allocate memory for the struct
-						temp->id = i;                            
-						temp->price = price;
-						temp->volume = volume;
-						temp->timestamp = timestamp;
-
-						int result = pthread_create(&producers[tid], NULL, producer_thread, (void *)temp);
-						// Check if thread creation was successful
-						if (result != 0) {
-							fprintf(stderr, "Error creating thread: %d\n", result);
-							free(temp);
-						}
-						
-						tid++;
-                    }
-                    // Exit loop when maximum amount of threads is created to avoid stack smashing
-                	if (tid >= NUM_THREADS) break;
-                    
+        case LWS_CALLBACK_CLIENT_RECEIVE_PONG:
+            // Only the pong of the outstanding ping counts, a late one would understate the RTT
+            if (len == sizeof(long long) && ping_sent_us) {
+                long long sent;
+                memcpy(&sent, in, sizeof(sent));
+                if (sent == ping_sent_us) {
+                    hist_record(&ping_rtt, rt_now_us() - sent);
+                    ping_sent_us = 0;
                 }
-                // Exit loop when maximum amount of threads is created to avoid stack smashing
-                if (tid >= NUM_THREADS) break;
             }
-            
-            json_decref(root);
             break;
 
+        // lws takes one write per writeable callback, so the subscribes are sent one at a time and a
+        // due ping waits until they are all out. The callback is requested again while either is pending.
         case LWS_CALLBACK_CLIENT_WRITEABLE:
-            printf("[Main Service] The websocket is writeable.\n");
+            if (!writeable_flag) {
+                printf("[Main Service] The websocket is writeable.\n");
+                //Set flags
+                writeable_flag = 1;
+            }
             //Subscribe to the symbols
-            websocket_write_back(wsi);
-            //Set flags
-            writeable_flag = 1;
+            if (subscribed < NUM_SYMBOLS) websocket_write_back(wsi);
+            else if (ping_due) send_ping(wsi);
+            if (subscribed < NUM_SYMBOLS || ping_due) lws_callback_on_writable(wsi);
             break;
 		
 		
         // This case is called when the connection is closed
         case LWS_CALLBACK_CLIENT_CLOSED:
             printf("[Main Service] WebSocket connection closed. Attempting to reconnect...\n");
-            destroy_flag = 1;
+            metrics_add(METRIC_RECONNECTS, 1);
+            connection_flag = 0;
+            if (!reconnect_flag) destroy_flag = 1;
             
             break;
 
+        // The connection's user data is freed after this, with the message buffer in it
+        case LWS_CALLBACK_WSI_DESTROY:
+            if (user) {
+                MessageBuffer *message = user;
+                free(message->buf);
+                memset(message, 0, sizeof(MessageBuffer));
+            }
+            break;
+
             
         default:
             break;
@@ -243,22 +482,291 @@ static int ws_callback_echo(struct lws *wsi, enum lws_callback_reasons reason, v
 
 
 
+// Resident set size in KB, read from /proc
+static long current_rss_kb() {
+    long pages = 0, resident = 0;
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file) return -1;
+    if (fscanf(file, "%ld %ld", &pages, &resident) != 2) resident = -1;
+    fclose(file);
+    return resident < 0 ? -1 : resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Print the RSS, the peak RSS and the parser allocations that fell back to the heap since the
+// last report. Other heap allocations are not counted here, rtes-bench counts all of them.
+static void print_memory_report(unsigned long long last_heap_allocs) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    size_t queued, queue_high;
+    unsigned long long queue_dropped;
+    trade_queue_stats(&queued, &queue_high, &queue_dropped);
+    printf("[Memory] rss=%ld KB peak=%ld KB arena overflows to heap=%llu/min frame arena high water=%zu/%zu total overflows=%llu "
+           "queue high water=%zu/%d dropped=%llu duplicates=%llu dedup evictions=%llu\n",
+           current_rss_kb(), usage.ru_maxrss, arena_heap_allocs() - last_heap_allocs,
+           frame_arena.high_water, frame_arena.size, feeds_arena_overflows(),
+           queue_high, config.queue_size, queue_dropped, metrics_total(METRIC_DUPLICATES), dedup_evictions());
+}
+
+// Print the CPU time and wake-ups of the process, used to compare idle cost
+static void print_cpu_report() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("[Main] CPU user=%ld ms system=%ld ms, context switches voluntary=%ld involuntary=%ld\n",
+           usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000,
+           usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000,
+           usage.ru_nvcsw, usage.ru_nivcsw);
+    for (int i = 0; i < config.agg_workers; i++) {
+        pthread_mutex_lock(&agg_workers[i].lock);
+        printf("[Main] Aggregation worker %d woke up %lld times\n", i, agg_workers[i].wakeups);
+        pthread_mutex_unlock(&agg_workers[i].lock);
+    }
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        pthread_mutex_lock(&symbols[i].lock);
+        printf("[Main] %s was processed %lld times by worker %d\n", symbol_info[i].symbol, symbols[i].wakeups, worker_of(i));
+        pthread_mutex_unlock(&symbols[i].lock);
+    }
+}
+
+// Print the bytes received on the wire against the decoded payload, and the CPU time the
+// websocket thread spent outside parsing (TLS, inflating and framing), to compare --deflate settings
+static void print_wire_report() {
+    unsigned long long wire = metrics_total(METRIC_WIRE_BYTES);
+    unsigned long long decoded = metrics_total(METRIC_DECODED_BYTES);
+    unsigned long long cpu = metrics_total(METRIC_SERVICE_CPU_US);
+    printf("[Wire] deflate=%s received=%llu bytes decoded=%llu bytes ratio=%.2f service CPU=%llu ms (%.2f us/KB decoded)\n",
+           deflate_enabled ? deflate_offer : "off", wire, decoded, wire ? (double)decoded / wire : 0.0,
+           cpu / 1000, decoded ? cpu * 1024.0 / decoded : 0.0);
+    printf("[Wire] fragmented messages=%llu fragments=%llu oversize messages=%llu\n",
+           metrics_total(METRIC_FRAGMENTED_MESSAGES), metrics_total(METRIC_MESSAGE_FRAGMENTS),
+           metrics_total(METRIC_OVERSIZE_MESSAGES));
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -l, --lateness MS       allowed lateness of a trade behind the newest one (default %lld)\n"
+            "  -i, --idle-timeout MS   close windows by wall clock after this long without trades (default %lld)\n"
+            "  -c, --corrections       emit corrected candles for trades that arrive after their window\n"
+            "  -R, --realtime          pin net=0,writer=1,agg=2 with SCHED_FIFO 80/70/60 and mlockall\n"
+            "      --cpus LIST         pin roles to cores, e.g. net=0,writer=1,agg=2\n"
+            "      --rt-priority LIST  SCHED_FIFO priorities, e.g. net=80,writer=70,agg=60\n"
+            "      --mlock             lock all memory with mlockall\n"
+            "  -j, --jitter SECONDS    report receive-to-process and wake-up latency every SECONDS\n"
+            "  -q, --queue-size N      trades that can wait for each producer (default %d)\n"
+            "  -a, --arena-size BYTES  memory for parsing one frame (default %d)\n"
+            "  -m, --mem-report        print RSS, arena overflows to the heap and queue use every minute\n"
+            "      --metrics FILE      rewrite FILE with Prometheus text metrics periodically\n"
+            "      --metrics-interval SECONDS  seconds between metrics updates (default %d)\n"
+            "  -s, --scale LIST        ticks per unit of price[:volume], e.g. AAPL=10000:1000,MSFT=100\n"
+            "                          or 100 for all symbols (default %d:%d)\n"
+            "      --quiet             do not log every trade and every aggregation wake-up\n"
+            "  -z, --deflate           negotiate permessage-deflate compression\n"
+            "      --deflate-window BITS  LZ77 window offered for both directions, 9-15 (default %d)\n"
+            "      --deflate-mem LEVEL    zlib memory level of the compressor, 1-9 (default %d)\n"
+            "      --record FILE       append every received message to FILE for --replay\n"
+            "      --replay FILE       merge the trades of a recording with the websocket (repeatable)\n"
+            "      --replay-speed X    replay at X times the recorded pace, 0 as fast as possible (default 1)\n"
+            "      --merge-delay MS    longest a trade is held back waiting for slower feeds (default %lld)\n"
+            "      --dedup-window MS   remember trades this long to drop copies, 0 disables (default %lld)\n"
+            "      --dedup-size N      trades remembered, size for the peak rate times the window (default %d)\n"
+            "      --ping-interval MS  send a websocket ping every MS and record its RTT, 0 disables (default %lld)\n"
+            "      --stall-timeout MS  reconnect after MS without a pong, or without trades during market hours,\n"
+            "                          0 disables (default %lld)\n"
+            "      --market-hours HH:MM-HH:MM  market hours in New York time on weekdays, or always (default 09:30-16:00)\n"
+            "      --keep-trades DAYS  drop raw trades older than DAYS (default keep all)\n"
+            "      --keep-candles DAYS compact minute candlesticks older than DAYS into hourly ones (default keep all)\n"
+            "      --disk-budget MB    drop the oldest trades, then minute candlesticks, beyond MB on disk\n"
+            "      --retention-interval SECONDS  seconds between retention passes (default %d)\n"
+            "      --shutdown-timeout MS  time to drain the pipeline after SIGINT or SIGTERM (default %d)\n"
+            "      --agg-workers N     aggregation worker threads, at most %d (default one per online CPU)\n"
+            "      --alerts FILE       check the rules in FILE on every trade and candlestick, one per line:\n"
+            "                          SYMBOL|* cross PRICE, move [-]PCT%% WINDOW[s|m|h] or volume Kx\n"
+            "      --alert-out PATH    append fired alerts to PATH or send them to udp:HOST:PORT (default stdout)\n"
+            "      --max-message BYTES largest websocket message collected from fragments, larger ones are skipped\n"
+            "                          (default %zu)\n",
+            name, config.lateness, config.idle_timeout, config.queue_size, config.arena_size, config.metrics_interval,
+            DEFAULT_PRICE_SCALE, DEFAULT_VOLUME_SCALE, deflate_window, deflate_mem_level, merge_delay_ms,
+            config.dedup_window, config.dedup_size, ping_interval, stall_timeout, config.retention_interval,
+            config.shutdown_timeout, MAX_AGG_WORKERS, max_message);
+}
+
 int main(int argc, char **argv) {
-	// Initialize the mutex
-    pthread_mutex_init(&mutex, NULL);
+    static struct option long_options[] = {
+        {"lateness", required_argument, 0, 'l'},
+        {"idle-timeout", required_argument, 0, 'i'},
+        {"corrections", no_argument, 0, 'c'},
+        {"realtime", no_argument, 0, 'R'},
+        {"cpus", required_argument, 0, 'P'},
+        {"rt-priority", required_argument, 0, 'F'},
+        {"mlock", no_argument, 0, 'M'},
+        {"jitter", required_argument, 0, 'j'},
+        {"queue-size", required_argument, 0, 'q'},
+        {"arena-size", required_argument, 0, 'a'},
+        {"mem-report", no_argument, 0, 'm'},
+        {"metrics", required_argument, 0, 'E'},
+        {"metrics-interval", required_argument, 0, 'I'},
+        {"scale", required_argument, 0, 's'},
+        {"quiet", no_argument, 0, 'Q'},
+        {"deflate", no_argument, 0, 'z'},
+        {"deflate-window", required_argument, 0, 'W'},
+        {"deflate-mem", required_argument, 0, 'L'},
+        {"record", required_argument, 0, 'r'},
+        {"replay", required_argument, 0, 'p'},
+        {"replay-speed", required_argument, 0, 'S'},
+        {"merge-delay", required_argument, 0, 'D'},
+        {"dedup-window", required_argument, 0, 'X'},
+        {"dedup-size", required_argument, 0, 'Y'},
+        {"ping-interval", required_argument, 0, 'G'},
+        {"stall-timeout", required_argument, 0, 'T'},
+        {"market-hours", required_argument, 0, 'H'},
+        {"keep-trades", required_argument, 0, 'K'},
+        {"keep-candles", required_argument, 0, 'C'},
+        {"disk-budget", required_argument, 0, 'B'},
+        {"retention-interval", required_argument, 0, 'N'},
+        {"shutdown-timeout", required_argument, 0, 'O'},
+        {"agg-workers", required_argument, 0, 'A'},
+        {"alerts", required_argument, 0, 'U'},
+        {"alert-out", required_argument, 0, 'V'},
+        {"max-message", required_argument, 0, 'Z'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    rt_config_init(&config.rt);
+    double replay_speed = 1;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "l:i:cRj:q:a:ms:zh", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'l': config.lateness = atoll(optarg); break;
+            case 'i': config.idle_timeout = atoll(optarg); break;
+            case 'c': config.corrections = 1; break;
+            case 'R': rt_config_default(&config.rt); break;
+            case 'P':
+                if (rt_parse_roles(optarg, config.rt.cpu) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 'F':
+                if (rt_parse_roles(optarg, config.rt.priority) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 'M': config.rt.lock_memory = 1; break;
+            case 'j': config.jitter_interval = atoi(optarg); break;
+            case 'q': config.queue_size = atoi(optarg); break;
+            case 'a': config.arena_size = atoi(optarg); break;
+            case 'm': config.mem_report = 1; break;
+            case 'E': config.metrics_file = optarg; break;
+            case 'I': config.metrics_interval = atoi(optarg); break;
+            case 's':
+                if (parse_scales(optarg) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 'Q': config.quiet = 1; break;
+            case 'z': deflate_enabled = 1; break;
+            case 'W': deflate_window = atoi(optarg); break;
+            case 'L': deflate_mem_level = atoi(optarg); break;
+            case 'r':
+                record_file = fopen(optarg, "a");
+                if (!record_file) { fprintf(stderr, "[Main] Could not open %s.\n", optarg); return 1; }
+                break;
+            case 'p':
+                if (feed_add_replay(optarg, replay_speed) < 0) {
+                    fprintf(stderr, "[Main] At most %d feeds are supported.\n", MAX_FEEDS);
+                    return 1;
+                }
+                break;
+            case 'S':
+                replay_speed = atof(optarg);
+                for (int i = 1; i < num_feeds; i++) feeds[i].speed = replay_speed;
+                break;
+            case 'D': merge_delay_ms = atoll(optarg); break;
+            case 'X': config.dedup_window = atoll(optarg); break;
+            case 'Y': config.dedup_size = atoi(optarg); break;
+            case 'K': config.keep_trades = (long long)(atof(optarg) * 24 * 3600 * 1000); break;
+            case 'C': config.keep_candles = (long long)(atof(optarg) * 24 * 3600 * 1000); break;
+            case 'B': config.disk_budget = (long long)(atof(optarg) * 1024 * 1024); break;
+            case 'N': config.retention_interval = atoi(optarg); break;
+            case 'O': config.shutdown_timeout = atoi(optarg); break;
+            case 'A': config.agg_workers = atoi(optarg); break;
+            case 'U': alert_rules = optarg; break;
+            case 'V': alert_out = optarg; break;
+            case 'Z': max_message = strtoull(optarg, NULL, 10); break;
+            case 'G': ping_interval = atoll(optarg); break;
+            case 'T': stall_timeout = atoll(optarg); break;
+            case 'H': {
+                int oh, om, ch, cm;
+                if (strcmp(optarg, "always") == 0) {
+                    market_always = 1;
+                } else if (sscanf(optarg, "%d:%d-%d:%d", &oh, &om, &ch, &cm) == 4 &&
+                           oh >= 0 && oh <= 24 && om >= 0 && om <= 59 && ch >= 0 && ch <= 24 && cm >= 0 && cm <= 59) {
+                    market_open_min = oh * 60 + om;
+                    market_close_min = ch * 60 + cm;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            }
+            default: usage(argv[0]); return 1;
+        }
+    }
+    stall_limit = stall_timeout;
+    int realtime = config.rt.lock_memory;
+    for (int i = 0; i < RT_NUM_ROLES; i++) {
+        if (config.rt.cpu[i] >= 0 || config.rt.priority[i] > 0) realtime = 1;
+    }
+    rt_lock_memory(&config.rt);
+    if (max_message < 1) {
+        fprintf(stderr, "[Main] The largest message must be at least 1 byte.\n");
+        return 1;
+    }
+    if (deflate_window < 9 || deflate_window > 15 || deflate_mem_level < 1 || deflate_mem_level > 9) {
+        fprintf(stderr, "[Main] The deflate window must be 9-15 bits and the memory level 1-9.\n");
+        return 1;
+    }
+    // Offer the same window for both directions, the server may answer with a smaller one
+    snprintf(deflate_offer, sizeof(deflate_offer),
+             "permessage-deflate; server_max_window_bits=%d; client_max_window_bits=%d",
+             deflate_window, deflate_window);
+    if (config.lateness < 0 || config.lateness >= AGG_MAX_AHEAD * AGG_WINDOW_MS) {
+        fprintf(stderr, "[Main] Lateness must be between 0 and %lld ms.\n", AGG_MAX_AHEAD * AGG_WINDOW_MS - 1);
+        return 1;
+    }
+    if (!market_always && (market_open_min >= market_close_min || market_close_min > 24 * 60)) {
+        fprintf(stderr, "[Main] The market hours must open before they close, within 00:00-24:00.\n");
+        return 1;
+    }
+
+    // Everything the ingestion path needs is allocated once, here
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (config.queue_size < 1 || queue_init(&trade_queues[i], config.queue_size, sizeof(TradeData)) != 0) {
+            fprintf(stderr, "[Main] Could not allocate the trade queues.\n");
+            return 1;
+        }
+    }
+    if (config.arena_size < 1 || arena_init(&frame_arena, config.arena_size) != 0) {
+        fprintf(stderr, "[Main] Could not allocate the frame arena.\n");
+        return 1;
+    }
+    if (dedup_sets_init() != 0) {
+        fprintf(stderr, "[Main] Could not allocate the dedup sets.\n");
+        return 1;
+    }
+    json_set_alloc_funcs(arena_malloc, arena_free);
+    metrics_init(NUM_SYMBOLS, symbol_names);
+    if (config.metrics_interval < 1) config.metrics_interval = 1;
     
-	// Register the signal SIGINT handler
+	// Register the SIGINT and SIGTERM handler, without SA_RESTART so it interrupts lws_service
     struct sigaction act;
     act.sa_handler = interrupt_handler;
     act.sa_flags = 0;
     sigemptyset(&act.sa_mask);
     sigaction( SIGINT, &act, 0);
+    sigaction(SIGTERM, &act, 0);
 
 	// Initialize JSON files for each symbol
-    const char *symbol_names[3] = {"AAPL", "GOOG", "MSFT"};    
     for (int i = 0; i < NUM_SYMBOLS; i++) {
         initialize_json(symbol_names[i], &symbols[i]);   
     }
+    checkpoint_check(CHECKPOINT_FILE);
+    // Rules are compiled with the scales of the data files
+    if (alert_rules && alert_init(alert_rules, alert_out) < 0) return 1;
+    agg_workers_init();
     
     // Initialize websocket structs
     struct lws_context *context = NULL;
@@ -269,6 +777,7 @@ int main(int argc, char **argv) {
     memset(&info, 0, sizeof info);
     info.port = CONTEXT_PORT_NO_LISTEN; 
     info.protocols = protocols; 
+    if (deflate_enabled) info.extensions = extensions;
     info.gid = -1; 
     info.uid = -1;
     info.ssl_ca_filepath = "/etc/ssl/certs/ca-certificates.crt"; 
@@ -325,203 +834,126 @@ int main(int argc, char **argv) {
 
     printf("[Main] Successful web socket instance creation.\n");
     
-    // Start consumer threads
-    for (int i = 0; i < NUM_SYMBOLS; i++) {
+    // Start the producer and aggregation threads. They block the stop signals, so the signals reach the
+    // main thread and wake it from lws_service.
+    sigset_t stop_signals, previous_mask;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &previous_mask);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        int* id = malloc(sizeof(int));
+        *id = i;
+        rt_thread_create(&config.rt, RT_ROLE_WRITER, &producers[i], producer_thread, id);
+    }
+    for (int i = 0; i < config.agg_workers; i++) {
     	int* id = malloc(sizeof(int));
     	*id = i;
-        pthread_create(&consumers[i], NULL, consumer_thread, id);
-    }
-    
-    while(!destroy_flag){
-        // Service the WebSocket
-        lws_service(context, 1000);
-
-        // Print the flags status
-        printf("Flags-Status\n");
-        printf("C: %d, W: %d, D: %d\n", connection_flag, writeable_flag, destroy_flag);
-
-    }
-
-	// Destroy the websocket connection
-    lws_context_destroy(context);
-    return 0;
-}
-
-// Initialize JSON files for each symbol
-void initialize_json(const char* symbol, SymbolData* data) {
-    snprintf(data->symbol, BUFFER_SIZE, "%s", symbol);
-    snprintf(data->trade_file, BUFFER_SIZE, "%s.json", symbol);
-    snprintf(data->cand_file, BUFFER_SIZE, "%s_cand.json", symbol);
-    snprintf(data->mov_file, BUFFER_SIZE, "%s_mov.json", symbol);
-	
-	/*
-    const char* types[] = {"trade", "candlestick", "moving_average"};
-    const char* file_names[] = {data->trade_file, data->cand_file, data->mov_file};
-	
-	
-	// Loop to delete existing files if they exist
-    for (int i = 0; i < 3; i++) {
-        if (remove(file_names[i]) == 0) {
-            printf("Main: Deleted existing file %s\n", file_names[i]);
-        } else {
-            printf("Main: No existing file %s to delete\n", file_names[i]);
-        }
+        rt_thread_create(&config.rt, RT_ROLE_AGG, &aggregators[i], aggregator_thread, id);
     }
-
-	// Loop to create and initialize new JSON files
-    for (int i = 0; i < 3; i++) {
-        json_t* json_obj = json_object();
-        json_object_set_new(json_obj, "type", json_string(types[i]));
-        json_object_set_new(json_obj, "data", json_array());
-
-        FILE* file = fopen(file_names[i], "w");
-        if (file) {
-            json_dumpf(json_obj, file, JSON_INDENT(4));
-            fclose(file);
-        }
-        json_decref(json_obj);
+    if (config.metrics_file) {
+        pthread_create(&metrics_writer, NULL, metrics_thread, NULL);
     }
-    */
-    printf("Main: Initialized %s JSON files\n", symbol);
-}
-
-// Add trade sample to the JSON file (Producer)
-void add_trade_sample(const char* file_path, double price, const char* symbol, long long timestamp, double volume) {
-    FILE* file = fopen(file_path, "r+");
-    if (!file) return;
-
-    json_error_t error;
-    json_t* root = json_loadf(file, 0, &error);
-    if (!root) {
-        printf("Error loading %s JSON: %s\n", file_path, error.text);
-        fclose(file);
-        exit(1);
+    int retaining = config.keep_trades > 0 || config.keep_candles > 0 || config.disk_budget > 0;
+    if (retaining) {
+        if (config.retention_interval < 1) config.retention_interval = 1;
+        pthread_create(&retention, NULL, retention_thread, NULL);
     }
-
-    json_t* data_array = json_object_get(root, "data");
-    json_t* trade = json_pack("{s:f, s:s, s:I, s:f, s:i}",
-                              "p", price, "s", symbol, "t", timestamp, "v", volume, "d", 0);
-
-    json_array_append_new(data_array, trade);
-    fseek(file, 0, SEEK_SET);
-    json_dumpf(root, file, JSON_INDENT(4));
-
-    json_decref(root);
-    fclose(file);
-}
-
-// Process trades (Consumer)
-int process_trades(const char *trade_file, const char *cand_file, const char *mov_file) {
-    json_t *root, *trade, *data_array, *cand_root, *mov_root;
-    json_error_t error;
-
-    long long current_time = current_time_ms();
-    long long time_threshold_1 = current_time - 60 * 1000;  // 1 minute ago
-    long long time_threshold_15 = current_time - 15 * 60 * 1000;  // 15 minutes ago
-
-    root = json_load_file(trade_file, 0, &error);
-    if (!root) {
-        fprintf(stderr, "Error loading %s JSON: %s\n", trade_file, error.text);
-        exit(1);
+    if (feeds_start() != 0) {
+        fprintf(stderr, "[Main] Could not start the replay feeds.\n");
+        return 1;
     }
+    pthread_sigmask(SIG_SETMASK, &previous_mask, NULL);
 
-    data_array = json_object_get(root, "data");
+    // The main thread services the websocket, pin it after the workers have been started
+    rt_apply_self(&config.rt, RT_ROLE_NET);
+    const char *mode = realtime ? "realtime" : "default";
+    long long last_report = current_time_ms();
+    long long last_mem_report = current_time_ms();
+    unsigned long long last_heap_allocs = arena_heap_allocs();
+    int last_flags = -1;
+    long long next_reconnect = 0;
 
-    double prices_1[BUFFER_SIZE], volumes_1[BUFFER_SIZE], prices_15[BUFFER_SIZE], volumes_15[BUFFER_SIZE];
-    size_t index_1 = 0, index_15 = 0;
-
-    size_t index;
-    json_array_foreach(data_array, index, trade) {
-        long long t = json_integer_value(json_object_get(trade, "t"));
-        double p = json_real_value(json_object_get(trade, "p"));
-        double v = json_real_value(json_object_get(trade, "v"));
-        if (index_1 < BUFFER_SIZE && t >= time_threshold_1 && t <= current_time) {
-            prices_1[index_1] = p;
-            volumes_1[index_1] = v;
-            index_1++;
-        }
-        if (index_15 < BUFFER_SIZE && t >= time_threshold_15 && t <= current_time) {
-            prices_15[index_15] = p;
-            volumes_15[index_15] = v;
-            index_15++;
+    while(!destroy_flag){
+        // Service the WebSocket, waking up early only for the periodic reports
+        int timeout = 60 * 1000;
+        if (config.jitter_interval > 0 && config.jitter_interval * 1000 < timeout) timeout = config.jitter_interval * 1000;
+        // and often enough to send pings and notice a stall a fraction of the timeout late
+        if (ping_interval > 0 && ping_interval < timeout) timeout = ping_interval;
+        if (stall_timeout > 0 && stall_timeout / 4 < timeout) timeout = stall_timeout / 4 > 250 ? stall_timeout / 4 : 250;
+        long long service_cpu = rt_thread_cpu_us();
+        lws_service(context, timeout);
+        // CPU time of the service call minus what the receive callback spent parsing
+        service_cpu = rt_thread_cpu_us() - service_cpu - parse_cpu_us;
+        parse_cpu_us = 0;
+        if (service_cpu > 0) metrics_add(METRIC_SERVICE_CPU_US, service_cpu);
+
+        check_liveness(wsi);
+        // Connect again after the stall detector closed the connection, once a second until it succeeds
+        if (reconnect_flag && !connection_flag && current_time_ms() >= next_reconnect) {
+            next_reconnect = current_time_ms() + 1000;
+            writeable_flag = 0;
+            printf("[Liveness] Connecting to %s.\n", clientConnectionInfo.address);
+            wsi = lws_client_connect_via_info(&clientConnectionInfo);
         }
-    }
 
-    if (index_1 > 0) { // Process candlestick data
-        // Compute high, low, and volume for the last minute
-        double high_price = prices_1[0];
-        double low_price = prices_1[0];
-        double total_volume = volumes_1[0];
-        for (size_t i = 1; i < index_1; i++) {
-            if (prices_1[i] > high_price) {
-                high_price = prices_1[i];
-            }
-            if (prices_1[i] < low_price) {
-                low_price = prices_1[i];
-            }
-            total_volume += volumes_1[i];
+        // Print the flags status when it changes
+        int flags = connection_flag << 2 | writeable_flag << 1 | destroy_flag;
+        if (flags != last_flags) {
+            last_flags = flags;
+            printf("Flags-Status\n");
+            printf("C: %d, W: %d, D: %d\n", connection_flag, writeable_flag, destroy_flag);
         }
 
-        cand_root = json_load_file(cand_file, 0, &error);
-        if (!cand_root) {
-            fprintf(stderr, "Error loading candlestick JSON: %s\n", error.text);
-            json_decref(root);
-            exit(1);
+        // Periodic jitter report
+        if (config.jitter_interval > 0 && current_time_ms() - last_report >= config.jitter_interval * 1000LL) {
+            last_report = current_time_ms();
+            printf("[Jitter] mode=%s\n", mode);
+            hist_print(stdout, "[Jitter] receive-to-process", "us", &process_latency);
+            hist_print(stdout, "[Jitter] aggregation wake-up", "us", &wakeup_latency);
+            if (ping_interval > 0) hist_print(stdout, "[Jitter] ping RTT", "us", &ping_rtt);
+            if (alert_rules) hist_print(stdout, "[Jitter] trade-to-alert", "us", &alert_latency);
+            if (num_feeds > 1) feeds_report(stdout);
         }
 
-        json_t *cand_data = json_object_get(cand_root, "data");
-        json_t *cand_entry = json_object();
-        json_object_set_new(cand_entry, "open", json_real(prices_1[0]));
-        json_object_set_new(cand_entry, "close", json_real(prices_1[index_1 - 1]));
-        json_object_set_new(cand_entry, "high", json_real(high_price));
-        json_object_set_new(cand_entry, "low", json_real(low_price));
-        json_object_set_new(cand_entry, "v", json_real(total_volume));
-        json_object_set_new(cand_entry, "t", json_integer(current_time));
-        json_array_append_new(cand_data, cand_entry);
-
-        FILE *file = fopen(cand_file, "w");
-        if (file != NULL) {
-            json_dumpf(cand_root, file, JSON_INDENT(4));
-            fclose(file);
+        // Memory report every minute
+        if (config.mem_report && current_time_ms() - last_mem_report >= 60 * 1000) {
+            last_mem_report = current_time_ms();
+            print_memory_report(last_heap_allocs);
+            last_heap_allocs = arena_heap_allocs();
         }
-
-        json_decref(cand_root);
     }
 
-    if (index_15 > 0) { // Process moving average data
-    	double total_volume = volumes_15[0];
-        for (size_t i = 1; i < index_15; i++) {
-            total_volume += volumes_15[i];
-        }
-        
-        mov_root = json_load_file(mov_file, 0, &error);
-        if (!mov_root) {
-            fprintf(stderr, "Error loading moving average JSON: %s\n", error.text);
-            json_decref(root);
-            exit(1);
-        }
+    // Store what was received before the stop, within the shutdown deadline
+    int drained = drain_pipeline(retaining);
 
-        json_t *mov_data = json_object_get(mov_root, "data");
-        double sum_prices = 0;
-        for (size_t i = 0; i < index_15; i++) {
-            sum_prices += prices_15[i];
-        }
-        json_t *mov_entry = json_object();
-        json_object_set_new(mov_entry, "p", json_real(sum_prices / index_15));
-        json_object_set_new(mov_entry, "v", json_real(total_volume));
-        json_object_set_new(mov_entry, "t", json_integer(current_time));
-        json_object_set_new(mov_entry, "d", json_integer(current_time_ms() - current_time));
-        json_array_append_new(mov_data, mov_entry);
-
-        FILE *file = fopen(mov_file, "w");
-        if (file != NULL) {
-            json_dumpf(mov_root, file, JSON_INDENT(4));
-            fclose(file);
-        }
+    print_cpu_report();
+    print_wire_report();
+    if (ping_interval > 0 || stall_timeout > 0) {
+        printf("[Liveness] stall reconnects=%llu\n", metrics_total(METRIC_STALLS));
+        hist_print(stdout, "[Liveness] ping RTT", "us", &ping_rtt);
+    }
+    if (num_feeds > 1) feeds_report(stdout);
+    if (alert_rules) {
+        printf("[Alert] alerts=%llu\n", metrics_total(METRIC_ALERTS_FIRED));
+        hist_print(stdout, "[Alert] trade-to-alert", "us", &alert_latency);
+    }
+    if (record_file) fclose(record_file);
+    if (config.jitter_interval > 0) {
+        printf("[Jitter] final, mode=%s\n", mode);
+        hist_print(stdout, "[Jitter] receive-to-process", "us", &process_latency);
+        hist_print(stdout, "[Jitter] aggregation wake-up", "us", &wakeup_latency);
+    }
 
-        json_decref(mov_root);
+    // Threads that missed the deadline may still be writing, exit without waiting for them
+    if (drained != 0) {
+        fflush(stdout);
+        _exit(1);
     }
-    
-    json_decref(root);
-    return index_1;
+
+	// Destroy the websocket connection
+    long long closing = rt_now_us();
+    lws_context_destroy(context);
+    printf("[Shutdown] Closed the connection in %lld ms\n", (rt_now_us() - closing) / 1000);
+    return 0;
 }
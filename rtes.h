@@ -0,0 +1,199 @@
+#ifndef RTES_H
+#define RTES_H
+
+#include <pthread.h>
+#include "rtes_agg.h"
+#include "rtes_rt.h"
+#include "rtes_hist.h"
+#include "rtes_pool.h"
+#include "rtes_store.h"
+#include "rtes_dedup.h"
+#include "rtes_wheel.h"
+
+//Number of producer threads that write queued trades to the files
+#define NUM_THREADS 3
+// Symbols the per-symbol arrays are sized for. rtes uses the three in symbol_names, rtes-loadgen
+// is built with more to generate load over larger symbol sets.
+#ifndef NUM_SYMBOLS
+#define NUM_SYMBOLS 3
+#endif
+#define BUFFER_SIZE 1024
+#define MAX_CANDLES 16 // finalized windows collected per aggregation step
+#define CACHE_LINE 64
+#define MAX_AGG_WORKERS 16 // aggregation worker threads, independent of the number of symbols
+
+// Prices and volumes are carried as int64 ticks from parsing to storage: 1/10000 of a
+// currency unit and 1/1000 of a share unless --scale says otherwise
+#define DEFAULT_PRICE_SCALE 10000
+#define DEFAULT_VOLUME_SCALE 1000
+
+// Runtime configuration, set from the command line
+typedef struct {
+    long long lateness;         // how late a trade may arrive and still count towards its window, in ms
+    long long idle_timeout;     // wall clock watermark fallback when a symbol does not trade, in ms
+    int corrections;            // emit corrected candles for trades that arrive after their window
+    RtConfig rt;                // core pinning, SCHED_FIFO priorities and mlockall
+    int jitter_interval;        // seconds between jitter reports, 0 disables them
+    int queue_size;             // trades that can wait for each producer, allocated at startup
+    int arena_size;             // bytes available for parsing one frame, allocated at startup
+    int mem_report;             // print RSS and allocation counts every minute
+    const char *metrics_file;   // Prometheus text file, rewritten every metrics_interval seconds
+    int metrics_interval;
+    StoreScale scales[NUM_SYMBOLS]; // ticks per unit of every symbol, 0 selects the default
+    int quiet;                  // do not print a line for every trade and every aggregation wake-up
+    long long dedup_window;     // how long a trade is remembered to recognize copies, in ms, 0 disables
+    int dedup_size;             // trades remembered by all producers together, allocated at startup
+    long long keep_trades;      // raw trades older than this are dropped, in ms, 0 keeps them
+    long long keep_candles;     // minute candlesticks older than this are compacted into hourly ones, in ms, 0 keeps them
+    long long disk_budget;      // bytes all data files may take together, 0 for no limit
+    int retention_interval;     // seconds between retention passes
+    int shutdown_timeout;       // ms from a stop request until the pipeline must be drained
+    int agg_workers;            // aggregation worker threads, 0 starts one per online CPU
+} RtesConfig;
+
+// Structure to hold symbol-specific file paths
+// Cold configuration, written once by initialize_json and only read afterwards
+typedef struct {
+	char symbol[BUFFER_SIZE];
+    char trade_file[BUFFER_SIZE];
+    char cand_file[BUFFER_SIZE];
+    char mov_file[BUFFER_SIZE];
+    char hourly_file[BUFFER_SIZE]; // candlesticks compacted by the retention thread
+	StoreScale scale;       // ticks per unit of prices and volumes
+} SymbolInfo;
+
+// Hot state of a symbol. Each symbol starts on its own cache line and is only touched by the
+// producer that owns it (see producer_of) and by its aggregation worker, so symbols never share a line.
+// The fields written for every trade come first, the worker's files start a new line.
+typedef struct {
+	pthread_mutex_t lock;   // guards agg, the wake-up flags and timer
+	int idle;               // no deadline is scheduled for the symbol because nothing is pending
+	int notified;           // the symbol is on its worker's pending list
+	long long notified_us;  // when it was put on the list, rt_now_us
+	long long price;        // last trade, in ticks
+	long long timestamp;
+	long long volume;
+	StoreFile trade_store;  // appended to by the producer
+	StoreFile cand_store __attribute__((aligned(CACHE_LINE))); // appended to by the aggregation worker
+	StoreFile mov_store;
+	long long wakeups;      // times its worker processed the symbol
+	WheelTimer timer;       // deadline of the oldest open window, in the wheel of its worker
+	const SymbolInfo *info;
+	Aggregator agg __attribute__((aligned(CACHE_LINE))); // event-time windows of the symbol
+} __attribute__((aligned(CACHE_LINE))) SymbolData;
+
+typedef struct {
+	int id;
+	int feed;          // the feed the trade was received from
+	unsigned conditions; // hash of the trade's condition codes
+	long long price;   // ticks of the symbol's scale
+	long long timestamp;
+	long long volume;
+	long long recv_us; // monotonic time the frame was received
+	unsigned long long frame; // sequence number of the frame, unique over all feeds
+} TradeData;
+
+extern RtesConfig config;
+
+// Set when the program should stop
+extern volatile int destroy_flag;
+
+// Set once the producers have stored every queued trade, the aggregation workers then finalize
+// the windows that are ready and exit
+extern volatile int drained_flag;
+
+// An aggregation worker finalizes the windows of a shard of the symbols (see worker_of). A
+// producer puts a symbol on the pending list when a trade closed one of its windows or when it
+// has no deadline scheduled yet. The deadlines of all open windows are kept in the worker's timer
+// wheel, so the worker sleeps until the earliest of them or the next pending symbol.
+typedef struct {
+	pthread_mutex_t lock;   // guards pending
+	pthread_cond_t cond;    // wakes the worker, used with lock
+	int pending[NUM_SYMBOLS]; // symbols to process, each at most once (see SymbolData.notified)
+	int num_pending;
+	long long wakeups;
+	TimerWheel wheel;       // only touched by the worker, with the lock of the symbol it schedules
+} __attribute__((aligned(CACHE_LINE))) AggWorker;
+
+extern AggWorker agg_workers[MAX_AGG_WORKERS];
+
+// Worker that owns the aggregation of a symbol
+#define worker_of(id) ((id) % config.agg_workers)
+
+// An array of SymbolData and their names
+extern SymbolData symbols[NUM_SYMBOLS];
+extern SymbolInfo symbol_info[NUM_SYMBOLS];
+extern const char *symbol_names[NUM_SYMBOLS];
+
+// Trades waiting for each producer and the arena that frames are parsed in
+extern FixedQueue trade_queues[NUM_THREADS];
+extern Arena frame_arena;
+
+// Recently stored trades of the symbols each producer owns, to drop trades received twice
+extern DedupSet dedup_sets[NUM_THREADS];
+
+// The producer that owns a symbol, every trade of the symbol goes through its queue
+#define producer_of(id) ((id) % NUM_THREADS)
+
+// Jitter probe: receive-to-process latency of trades and lateness of aggregation wake-ups, in us.
+// A wake-up is late by the time from a producer's notification, or from the wheel deadline, until
+// the worker runs the symbol.
+extern Histogram process_latency;
+extern Histogram wakeup_latency;
+
+// Time from the end of a window until its candlestick is written, in ms
+extern Histogram emit_lag;
+
+// FUnction for the current time
+long long current_time_ms();
+
+// Parse a --scale list such as AAPL=10000:1000,MSFT=100, an entry without a symbol applies to
+// all symbols. Returns 0 on success and -1 on a malformed list or unknown symbol.
+int parse_scales(const char *list);
+
+// Convert a decimal price or volume to ticks, rounding to the nearest tick
+long long to_ticks(double value, long long scale);
+
+// Initialize JSON files for each symbol
+void initialize_json(const char* symbol, SymbolData* data);
+
+// Allocate the dedup sets of the producers. Call before initialize_json, which seeds them with
+// the end of the trade files. Returns 0 on success.
+int dedup_sets_init();
+
+// Checkpoint of a clean shutdown, written after the pipeline has been drained
+#define CHECKPOINT_FILE "checkpoint.json"
+
+// Sync the data files of every symbol and record their sizes in a checkpoint. Returns 0 on success.
+int checkpoint_write(const char *path, long long now);
+
+// Report whether the data files are unchanged since the checkpoint of the last clean shutdown,
+// then remove it. Call after initialize_json.
+void checkpoint_check(const char *path);
+
+// Trades waiting in all producer queues, and the largest backlog and drops of any of them
+void trade_queue_stats(size_t *depth, size_t *high_water, unsigned long long *dropped);
+
+// Parse a Finnhub message received from a feed and hand its trades on (see rtes_feed.h).
+// Returns the number of queued trades or -1 if the message is not valid JSON.
+int handle_frame(int feed, const char *in, size_t len, long long recv_us);
+
+// Add trade sample to the JSON file (Producer)
+int add_trade_sample(StoreFile *store, long long price, const char* symbol, long long timestamp, long long volume);
+
+// Process trades (Consumer)
+int process_trades(SymbolData *data, long long now);
+
+// Settle config.agg_workers and prepare the workers. Call after initialize_json and before
+// starting the producers.
+void agg_workers_init();
+
+// Wake every aggregation worker, so they notice drained_flag
+void agg_workers_wake();
+
+// Producer and aggregation worker thread functions, both take a malloc'd int: the producer or
+// worker index
+void* producer_thread(void* arg);
+void* aggregator_thread(void* arg);
+
+#endif
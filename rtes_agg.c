@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <string.h>
+#include "rtes_agg.h"
+
+// Start of the window that contains t
+static long long window_start(long long t) {
+    long long rem = t % AGG_WINDOW_MS;
+    return rem < 0 ? t - rem - AGG_WINDOW_MS : t - rem;
+}
+
+// Ring slot of the window that starts at start
+static AggBucket *bucket_at(Aggregator *agg, long long start) {
+    return &agg->buckets[(start / AGG_WINDOW_MS) % AGG_RING_SIZE];
+}
+
+static void bucket_reset(AggBucket *bucket, long long start) {
+    memset(bucket, 0, sizeof(AggBucket));
+    bucket->start = start;
+}
+
+// Add a trade to a window, open and close follow event time rather than arrival order
+static void bucket_add(AggBucket *bucket, long long t, long long price, long long volume) {
+    if (bucket->count == 0) {
+        bucket->first_t = bucket->last_t = t;
+        bucket->open = bucket->close = bucket->high = bucket->low = price;
+    } else {
+        if (t < bucket->first_t) {
+            bucket->first_t = t;
+            bucket->open = price;
+        }
+        if (t >= bucket->last_t) {
+            bucket->last_t = t;
+            bucket->close = price;
+        }
+        if (price > bucket->high) bucket->high = price;
+        if (price < bucket->low) bucket->low = price;
+    }
+    bucket->volume += volume;
+    bucket->price_sum += price;
+    bucket->count++;
+}
+
+// Add a reduced run of trades to a window, as bucket_add would add them one by one
+static void bucket_add_run(AggBucket *bucket, long long first_t, long long open, long long last_t, long long close,
+                           const Reduction *run) {
+    if (bucket->count == 0) {
+        bucket->first_t = first_t;
+        bucket->last_t = last_t;
+        bucket->open = open;
+        bucket->close = close;
+        bucket->high = run->max;
+        bucket->low = run->min;
+    } else {
+        if (first_t < bucket->first_t) {
+            bucket->first_t = first_t;
+            bucket->open = open;
+        }
+        if (last_t >= bucket->last_t) {
+            bucket->last_t = last_t;
+            bucket->close = close;
+        }
+        if (run->max > bucket->high) bucket->high = run->max;
+        if (run->min < bucket->low) bucket->low = run->min;
+    }
+    bucket->volume += run->volume;
+    bucket->price_sum += run->sum;
+    bucket->count += run->count;
+}
+
+// Initialize the aggregation state of a symbol
+void agg_init(Aggregator *agg, long long lateness, long long idle_timeout, int corrections) {
+    memset(agg, 0, sizeof(Aggregator));
+    for (int i = 0; i < AGG_RING_SIZE; i++) {
+        agg->buckets[i].start = -1;
+    }
+    agg->lateness = lateness;
+    agg->idle_timeout = idle_timeout > lateness ? idle_timeout : lateness;
+    agg->corrections = corrections;
+    agg->max_event_time = -1;
+    agg->watermark = -1;
+    agg->next_window = -1;
+}
+
+// Add a trade by its exchange timestamp
+int agg_add(Aggregator *agg, long long t, long long price, long long volume) {
+    long long start = window_start(t);
+    if (agg->next_window < 0) {
+        // The first trade opens the ring, leaving room for trades that are up to lateness behind it
+        agg->next_window = window_start(t - agg->lateness);
+    }
+
+    // A timestamp this far ahead would overwrite history that is still needed
+    if (start >= agg->next_window + AGG_MAX_AHEAD * AGG_WINDOW_MS) {
+        agg->dropped_trades++;
+        return -1;
+    }
+
+    AggBucket *bucket = bucket_at(agg, start);
+    if (start < agg->next_window) {
+        // The window has already been emitted
+        agg->late_trades++;
+        if (!agg->corrections || bucket->start != start) {
+            agg->dropped_trades++;
+            return -1;
+        }
+        bucket_add(bucket, t, price, volume);
+        bucket->corrected = 1;
+        return 1;
+    }
+
+    if (bucket->start != start) bucket_reset(bucket, start);
+    bucket_add(bucket, t, price, volume);
+    agg->trades++;
+    if (t > agg->max_event_time) agg->max_event_time = t;
+    return 0;
+}
+
+// Add a run of trades of one window, reduced with rtes_reduce
+int agg_add_run(Aggregator *agg, long long first_t, long long open, long long last_t, long long close,
+                const Reduction *run) {
+    if (run->count == 0) return 0;
+    long long start = window_start(first_t);
+    if (agg->next_window < 0) agg->next_window = window_start(first_t - agg->lateness);
+    if (start >= agg->next_window + AGG_MAX_AHEAD * AGG_WINDOW_MS) {
+        agg->dropped_trades += run->count;
+        return -1;
+    }
+
+    AggBucket *bucket = bucket_at(agg, start);
+    if (start < agg->next_window) {
+        agg->late_trades += run->count;
+        if (!agg->corrections || bucket->start != start) {
+            agg->dropped_trades += run->count;
+            return -1;
+        }
+        bucket_add_run(bucket, first_t, open, last_t, close, run);
+        bucket->corrected = 1;
+        return 1;
+    }
+
+    if (bucket->start != start) bucket_reset(bucket, start);
+    bucket_add_run(bucket, first_t, open, last_t, close, run);
+    agg->trades += run->count;
+    if (last_t > agg->max_event_time) agg->max_event_time = last_t;
+    return 0;
+}
+
+// Whether the event-time watermark has passed the oldest open window
+int agg_ready(const Aggregator *agg) {
+    return agg->next_window >= 0 && agg->max_event_time - agg->lateness >= agg->next_window + AGG_WINDOW_MS;
+}
+
+// Wall clock time at which agg_advance has work, -1 if nothing is pending
+long long agg_deadline(const Aggregator *agg) {
+    if (agg->next_window < 0) return -1;
+    int pending = 0;
+    for (int i = 0; i < AGG_RING_SIZE; i++) {
+        const AggBucket *bucket = &agg->buckets[i];
+        if (bucket->final && bucket->corrected) return 0;
+        // A window with trades is pending until the last moving average that includes it is emitted
+        if (bucket->count > 0 && bucket->start + (AGG_MOV_WINDOWS - 1) * AGG_WINDOW_MS >= agg->next_window) pending = 1;
+    }
+    if (!pending) return -1;
+    return agg->next_window + AGG_WINDOW_MS + agg->idle_timeout;
+}
+
+// Fill the candle of the window that starts at start, with the moving average over the
+// AGG_MOV_WINDOWS windows that end with it
+static void fill_candle(Aggregator *agg, long long start, AggCandle *candle) {
+    memset(candle, 0, sizeof(AggCandle));
+    candle->t = start + AGG_WINDOW_MS;
+
+    AggBucket *bucket = bucket_at(agg, start);
+    if (bucket->start == start && bucket->count > 0) {
+        candle->has_candle = 1;
+        candle->count = bucket->count;
+        candle->open = bucket->open;
+        candle->close = bucket->close;
+        candle->high = bucket->high;
+        candle->low = bucket->low;
+        candle->volume = bucket->volume;
+    }
+
+    long long price_sum = 0, volume_sum = 0;
+    long long count = 0;
+    for (int i = 0; i < AGG_MOV_WINDOWS; i++) {
+        long long w = start - i * AGG_WINDOW_MS;
+        AggBucket *m = bucket_at(agg, w);
+        if (m->start == w && m->count > 0) {
+            price_sum += m->price_sum;
+            volume_sum += m->volume;
+            count += m->count;
+            candle->mov_windows++;
+        }
+    }
+    if (count > 0) {
+        candle->has_mov = 1;
+        // Round half away from zero, the sum itself is exact
+        candle->mov_price = (price_sum + (price_sum < 0 ? -count : count) / 2) / count;
+        candle->mov_volume = volume_sum;
+    }
+}
+
+// Move the watermark and finalize every window that ends at or before it
+int agg_advance(Aggregator *agg, long long now, AggCandle *out, int max_out) {
+    int n = 0;
+    if (agg->next_window < 0) return 0;
+
+    // Re-emit windows that late trades changed after they were finalized
+    if (agg->corrections) {
+        for (int i = 0; i < AGG_RING_SIZE && n < max_out; i++) {
+            AggBucket *bucket = &agg->buckets[i];
+            if (!bucket->final || !bucket->corrected) continue;
+            fill_candle(agg, bucket->start, &out[n]);
+            out[n].correction = 1;
+            out[n].has_mov = 0;
+            bucket->corrected = 0;
+            agg->emitted_corrections++;
+            n++;
+        }
+    }
+
+    // The watermark follows the newest event time, or the wall clock while no trades arrive
+    long long watermark = agg->max_event_time - agg->lateness;
+    if (now - agg->idle_timeout > watermark) watermark = now - agg->idle_timeout;
+    if (watermark > agg->watermark) agg->watermark = watermark;
+
+    while (n < max_out && agg->next_window + AGG_WINDOW_MS <= agg->watermark) {
+        long long start = agg->next_window;
+        AggBucket *bucket = bucket_at(agg, start);
+        fill_candle(agg, start, &out[n]);
+        if (bucket->start != start) bucket_reset(bucket, start);
+        bucket->final = 1;
+        agg->next_window += AGG_WINDOW_MS;
+
+        if (out[n].has_candle || out[n].has_mov) {
+            n++;
+            continue;
+        }
+
+        // Nothing traded within the moving average window, skip ahead to the next window with
+        // trades or to the window that holds the watermark
+        long long next = window_start(agg->watermark);
+        for (int i = 0; i < AGG_RING_SIZE; i++) {
+            AggBucket *b = &agg->buckets[i];
+            if (b->start >= agg->next_window && b->start < next && b->count > 0) next = b->start;
+        }
+        if (next > agg->next_window) agg->next_window = next;
+    }
+    return n;
+}
+
+// Format a candlestick record
+int agg_format_candle(char *buf, size_t size, const AggCandle *c) {
+    return snprintf(buf, size, "{\"open\": %lld, \"close\": %lld, \"high\": %lld, \"low\": %lld, \"v\": %lld, \"t\": %lld%s}",
+                    c->open, c->close, c->high, c->low, c->volume, c->t, c->correction ? ", \"c\": 1" : "");
+}
+
+// Format a moving average record
+int agg_format_mov(char *buf, size_t size, const AggCandle *c, long long delay) {
+    return snprintf(buf, size, "{\"p\": %lld, \"v\": %lld, \"t\": %lld, \"d\": %lld}",
+                    c->mov_price, c->mov_volume, c->t, delay);
+}
@@ -0,0 +1,91 @@
+#ifndef RTES_AGG_H
+#define RTES_AGG_H
+
+#include <stddef.h>
+#include "rtes_reduce.h"
+
+// Length of a candlestick window and number of windows in the moving average
+#define AGG_WINDOW_MS (60 * 1000LL)
+#define AGG_MOV_WINDOWS 15
+
+// Number of one minute buckets kept per symbol. The ring holds the moving average history
+// plus the open windows, so it also bounds how far out of order a trade may arrive.
+#define AGG_RING_SIZE 64
+#define AGG_MAX_AHEAD (AGG_RING_SIZE - AGG_MOV_WINDOWS - 1)
+
+// One window of trades, keyed on exchange event time. Prices and volumes are fixed-point
+// ticks of the symbol's scale, so the sums are exact.
+typedef struct {
+    long long start;        // window start in ms, -1 if the slot is unused
+    long long first_t;      // event time of the opening trade
+    long long last_t;       // event time of the closing trade
+    long long open, close, high, low;
+    long long volume;
+    long long price_sum;    // sum of prices, for the moving average
+    long long count;
+    int final;              // window has been emitted
+    int corrected;          // late trades changed the window after it was emitted
+} AggBucket;
+
+// Event-time aggregation state of one symbol. The scalar fields come first so that they share a
+// cache line, the ring is only touched one bucket at a time.
+typedef struct {
+    long long lateness;         // allowed lateness in ms
+    long long idle_timeout;     // wall clock fallback for the watermark when no trades arrive
+    int corrections;            // re-emit windows changed by late trades
+    long long max_event_time;   // largest exchange timestamp seen
+    long long watermark;        // windows ending at or before the watermark are final
+    long long next_window;      // start of the oldest window not yet emitted, -1 before the first trade
+    long long trades;           // trades accepted into a window
+    long long late_trades;      // trades whose window had already been emitted
+    long long dropped_trades;   // late trades that could not be applied, or timestamps too far ahead
+    long long emitted_corrections;
+    AggBucket buckets[AGG_RING_SIZE];
+} Aggregator;
+
+// A finalized window, as written to the candlestick and moving average files
+typedef struct {
+    long long t;            // window end in ms
+    long long count;        // trades in the window
+    long long open, close, high, low, volume;
+    int has_candle;         // the window itself had trades
+    int has_mov;            // the moving average window had trades
+    long long mov_price;    // average price, rounded to the nearest tick
+    long long mov_volume;
+    int mov_windows;        // windows with trades in the moving average window
+    int correction;         // this is a correction of an already emitted window
+} AggCandle;
+
+// Initialize the aggregation state of a symbol
+void agg_init(Aggregator *agg, long long lateness, long long idle_timeout, int corrections);
+
+// Add a trade by its exchange timestamp, with price and volume in ticks.
+// Returns 0 if it was added to an open window, 1 if it was late and applied as a correction,
+// and -1 if it was dropped.
+int agg_add(Aggregator *agg, long long t, long long price, long long volume);
+
+// Add a run of trades that all fall into one window, reduced by rtes_reduce: the same as calling
+// agg_add for each of them, with first_t and open the earliest trade by event time and last_t and
+// close the latest (the last of equal timestamps). Returns what agg_add would return for each.
+int agg_add_run(Aggregator *agg, long long first_t, long long open, long long last_t, long long close,
+                const Reduction *run);
+
+// Whether the newest event time has moved the watermark past the end of the oldest open window,
+// so agg_advance would finalize it without waiting for the wall clock
+int agg_ready(const Aggregator *agg);
+
+// Wall clock time in ms at which agg_advance has work even if no more trades arrive,
+// or -1 when nothing is pending and the symbol is idle
+long long agg_deadline(const Aggregator *agg);
+
+// Move the watermark using the wall clock time now and finalize every window that ends at or
+// before it. Up to max_out finalized windows and corrections are stored in out, the number
+// stored is returned. Call again while the return value equals max_out.
+int agg_advance(Aggregator *agg, long long now, AggCandle *out, int max_out);
+
+// Format the candlestick and moving average records of a finalized window as they are stored,
+// delay being the "d" field of the moving average. Return the length, as snprintf does.
+int agg_format_candle(char *buf, size_t size, const AggCandle *candle);
+int agg_format_mov(char *buf, size_t size, const AggCandle *candle, long long delay);
+
+#endif
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include "rtes.h"
+#include "rtes_alert.h"
+#include "rtes_metrics.h"
+
+// A compiled rule: the threshold it fires at, in the unit its check compares with
+typedef struct {
+    double key;
+    const AlertRule *rule;
+} AlertEntry;
+
+// Rules of one kind sorted by key, a check binary-searches where the rules that fire start
+typedef struct {
+    AlertEntry *entries;
+    int count;
+} AlertList;
+
+// Move rules of one window. Rules are edge triggered: the first fired rules of each list are
+// those whose threshold the move is currently past, they fire again after it has fallen back.
+typedef struct {
+    long long window;       // seconds
+    AlertList up;           // percentages
+    AlertList down;         // magnitudes of the negative percentages
+    int fired_up;
+    int fired_down;
+} MoveGroup;
+
+// Compiled rules and their state for one symbol. The cross and move state is only touched by the
+// producer that owns the symbol, the volume rules by its aggregation worker.
+typedef struct {
+    int active;             // the symbol has cross or move rules
+    int has_last;
+    long long last_price;   // ticks of the previous trade
+    AlertList cross;        // levels in ticks
+    MoveGroup *moves;
+    int num_moves;
+    long long *history;     // last price of every second, a ring of history_size seconds
+    int history_size;
+    long long first_sec;    // first second of history, -1 before the first trade
+    long long last_sec;
+    AlertList volume __attribute__((aligned(CACHE_LINE))); // multiples
+} __attribute__((aligned(CACHE_LINE))) AlertSymbol;
+
+Histogram alert_latency;
+
+static AlertRule *rules = NULL;
+static int num_rules = 0;
+static AlertSymbol alert_symbols[NUM_SYMBOLS];
+static int sink_fd = -1;    // file or connected UDP socket, -1 for standard output
+static int sink_failed = 0;
+
+static const char *kind_names[] = {"cross", "move", "volume"};
+
+// Number of entries with a key below value, or at most value if inclusive
+static int bound(const AlertList *list, double value, int inclusive) {
+    int lo = 0, hi = list->count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        double key = list->entries[mid].key;
+        if (key < value || (inclusive && key == value)) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+static int compare_entries(const void *a, const void *b) {
+    double x = ((const AlertEntry *)a)->key, y = ((const AlertEntry *)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+static int list_add(AlertList *list, double key, const AlertRule *rule) {
+    AlertEntry *entries = realloc(list->entries, (list->count + 1) * sizeof(AlertEntry));
+    if (!entries) return -1;
+    entries[list->count].key = key;
+    entries[list->count].rule = rule;
+    list->entries = entries;
+    list->count++;
+    return 0;
+}
+
+static void list_sort(AlertList *list) {
+    if (list->count > 1) qsort(list->entries, list->count, sizeof(AlertEntry), compare_entries);
+}
+
+// Format ticks as a decimal number, exactly when the scale is a power of ten
+static int format_ticks(char *buf, size_t size, long long ticks, long long scale) {
+    int digits = 0;
+    long long s = scale;
+    while (s > 1 && s % 10 == 0) {
+        s /= 10;
+        digits++;
+    }
+    if (s != 1) return snprintf(buf, size, "%.6f", (double)ticks / scale);
+    long long whole = ticks / scale, frac = ticks % scale;
+    if (digits == 0) return snprintf(buf, size, "%lld", ticks);
+    return snprintf(buf, size, "%s%lld.%0*lld", ticks < 0 && whole == 0 ? "-" : "", whole, digits,
+                    frac < 0 ? -frac : frac);
+}
+
+// Write one alert. A single write per line keeps lines of concurrent threads whole.
+// x is the level crossed, the move in percent or the volume multiple.
+static void fire(const AlertRule *rule, int id, long long price, long long t, double x, long long latency) {
+    char line[512], p[64];
+    if (format_ticks(p, sizeof(p), price, symbol_info[id].scale.price) >= (int)sizeof(p)) return;
+    int len = snprintf(line, sizeof(line), "{\"r\": \"%s\", \"s\": \"%s\", \"k\": \"%s\", \"p\": %s, \"x\": %.6g, \"t\": %lld, \"l\": %lld}\n",
+                       rule->text, symbol_info[id].symbol, kind_names[rule->kind], p, x, t, latency);
+    if (len < 0 || len >= (int)sizeof(line)) return;
+    metrics_add(METRIC_ALERTS_FIRED, 1);
+    if (sink_fd < 0) {
+        fputs(line, stdout);
+    } else if (write(sink_fd, line, len) != len && !sink_failed) {
+        sink_failed = 1;
+        fprintf(stderr, "[Alert] Could not write an alert: %s\n", strerror(errno));
+    }
+}
+
+// Fire a trade rule and record how long after the trade was received its alert was written
+static void fire_trade(const AlertRule *rule, int id, long long price, long long t, double x, long long recv_us) {
+    long long latency = rt_now_us() - recv_us;
+    fire(rule, id, price, t, x, latency);
+    hist_record(&alert_latency, latency);
+}
+
+// Parse one line of the rules file, returns 1 for a rule, 0 for a blank line or comment, -1 on an error
+static int parse_rule(char *line, AlertRule *rule) {
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+    char *end = line + strlen(line);
+    while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+    while (*line == ' ' || *line == '\t') line++;
+    if (*line == '\0') return 0;
+
+    memset(rule, 0, sizeof(AlertRule));
+    snprintf(rule->text, sizeof(rule->text), "%s", line);
+    for (char *c = rule->text; *c; c++) {
+        if (*c == '"' || *c == '\\' || *c == '\t') *c = ' '; // the text is written into a JSON string
+    }
+
+    char *save;
+    char *symbol = strtok_r(line, " \t", &save);
+    char *kind = strtok_r(NULL, " \t", &save);
+    char *value = strtok_r(NULL, " \t", &save);
+    char *window = strtok_r(NULL, " \t", &save);
+    if (!kind || !value || strtok_r(NULL, " \t", &save)) return -1;
+
+    rule->symbol = -2;
+    if (strcmp(symbol, "*") == 0) rule->symbol = -1;
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        if (strcmp(symbol_names[i], symbol) == 0) rule->symbol = i;
+    }
+    if (rule->symbol == -2) return -1;
+
+    rule->value = strtod(value, &end);
+    if (strcmp(kind, "cross") == 0) {
+        rule->kind = ALERT_CROSS;
+        return end != value && *end == '\0' && rule->value > 0 && !window ? 1 : -1;
+    }
+    if (strcmp(kind, "volume") == 0) {
+        rule->kind = ALERT_VOLUME;
+        if (*end == 'x') end++;
+        return end != value && *end == '\0' && rule->value > 0 && !window ? 1 : -1;
+    }
+    if (strcmp(kind, "move") == 0) {
+        rule->kind = ALERT_MOVE;
+        if (end == value || strcmp(end, "%") != 0 || rule->value == 0 || !window) return -1;
+        rule->window = strtoll(window, &end, 10);
+        if (*end == 'm') rule->window *= 60;
+        else if (*end == 'h') rule->window *= 3600;
+        if (*end == 'm' || *end == 'h' || *end == 's') end++;
+        return *end == '\0' && rule->window >= 1 && rule->window <= ALERT_MAX_MOVE_SEC ? 1 : -1;
+    }
+    return -1;
+}
+
+// Compile the rules that apply to a symbol into its sorted lists
+static int compile_symbol(int id) {
+    AlertSymbol *a = &alert_symbols[id];
+    a->first_sec = -1;
+    long long longest = 0;
+    for (int i = 0; i < num_rules; i++) {
+        const AlertRule *rule = &rules[i];
+        if (rule->symbol != -1 && rule->symbol != id) continue;
+        if (rule->kind == ALERT_CROSS) {
+            if (list_add(&a->cross, to_ticks(rule->value, symbol_info[id].scale.price), rule) != 0) return -1;
+        } else if (rule->kind == ALERT_VOLUME) {
+            if (list_add(&a->volume, rule->value, rule) != 0) return -1;
+        } else {
+            MoveGroup *group = NULL;
+            for (int j = 0; j < a->num_moves; j++) {
+                if (a->moves[j].window == rule->window) group = &a->moves[j];
+            }
+            if (!group) {
+                MoveGroup *moves = realloc(a->moves, (a->num_moves + 1) * sizeof(MoveGroup));
+                if (!moves) return -1;
+                a->moves = moves;
+                group = &a->moves[a->num_moves++];
+                memset(group, 0, sizeof(MoveGroup));
+                group->window = rule->window;
+            }
+            AlertList *list = rule->value > 0 ? &group->up : &group->down;
+            if (list_add(list, rule->value > 0 ? rule->value : -rule->value, rule) != 0) return -1;
+            if (rule->window > longest) longest = rule->window;
+        }
+    }
+
+    list_sort(&a->cross);
+    list_sort(&a->volume);
+    for (int j = 0; j < a->num_moves; j++) {
+        list_sort(&a->moves[j].up);
+        list_sort(&a->moves[j].down);
+    }
+    if (a->num_moves > 0) {
+        a->history_size = longest + 1;
+        a->history = calloc(a->history_size, sizeof(long long));
+        if (!a->history) return -1;
+    }
+    a->active = a->cross.count > 0 || a->num_moves > 0;
+    return 0;
+}
+
+// Open the file or UDP socket that alerts are written to
+static int open_sink(const char *out) {
+    if (strncmp(out, "udp:", 4) != 0) {
+        sink_fd = open(out, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        return sink_fd < 0 ? -1 : 0;
+    }
+    char host[256];
+    snprintf(host, sizeof(host), "%s", out + 4);
+    char *port = strrchr(host, ':');
+    if (!port) return -1;
+    *port++ = '\0';
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) return -1;
+    sink_fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+    if (sink_fd >= 0 && connect(sink_fd, res->ai_addr, res->ai_addrlen) != 0) {
+        close(sink_fd);
+        sink_fd = -1;
+    }
+    freeaddrinfo(res);
+    return sink_fd < 0 ? -1 : 0;
+}
+
+// Parse the rules file and compile the rules of every symbol
+int alert_init(const char *rules_path, const char *out) {
+    FILE *file = fopen(rules_path, "r");
+    if (!file) {
+        fprintf(stderr, "[Alert] Could not open %s: %s\n", rules_path, strerror(errno));
+        return -1;
+    }
+    char line[BUFFER_SIZE];
+    int line_no = 0;
+    AlertRule rule;
+    while (fgets(line, sizeof(line), file)) {
+        line_no++;
+        int parsed = parse_rule(line, &rule);
+        if (parsed < 0) {
+            fprintf(stderr, "[Alert] %s:%d: expected SYMBOL|* cross PRICE, move [-]PCT%% WINDOW[s|m|h] or volume Kx\n",
+                    rules_path, line_no);
+            fclose(file);
+            return -1;
+        }
+        if (parsed == 0) continue;
+        AlertRule *grown = realloc(rules, (num_rules + 1) * sizeof(AlertRule));
+        if (!grown) {
+            fclose(file);
+            return -1;
+        }
+        rules = grown;
+        rules[num_rules++] = rule;
+    }
+    fclose(file);
+
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        if (compile_symbol(i) != 0) {
+            fprintf(stderr, "[Alert] Could not allocate the rules.\n");
+            return -1;
+        }
+    }
+    if (out && open_sink(out) != 0) {
+        fprintf(stderr, "[Alert] Could not open %s for the alerts\n", out);
+        return -1;
+    }
+    printf("[Alert] %d rules from %s, alerts to %s\n", num_rules, rules_path, out ? out : "standard output");
+    return num_rules;
+}
+
+// Record the price of the second of t, carrying the last price over the seconds without trades.
+// Returns 0 if the trade is older than the history and can not be compared with it.
+static int record_history(AlertSymbol *a, long long price, long long sec) {
+    if (a->first_sec < 0) {
+        a->first_sec = a->last_sec = sec;
+    } else if (sec < a->last_sec) {
+        return 0;
+    } else if (sec > a->last_sec) {
+        long long carried = a->history[a->last_sec % a->history_size];
+        for (long long s = a->last_sec + 1; s < sec && s <= a->last_sec + a->history_size; s++) {
+            a->history[s % a->history_size] = carried;
+        }
+        a->last_sec = sec;
+    }
+    a->history[sec % a->history_size] = price;
+    return 1;
+}
+
+// Fire the rules of a list that the value has newly reached, and return how many it has reached
+static int check_edge(const AlertList *list, int fired, double value, int id, long long price, long long t,
+                      double x, long long recv_us) {
+    int reached = bound(list, value, 1);
+    for (int i = fired; i < reached; i++) fire_trade(list->entries[i].rule, id, price, t, x, recv_us);
+    return reached;
+}
+
+// Check the trade and move rules of a symbol with one of its trades
+void alert_trade(int id, long long price, long long t, long long recv_us) {
+    AlertSymbol *a = &alert_symbols[id];
+    if (!a->active) return;
+
+    // A level is crossed when it lies in (lower, higher] of the previous and this price: reaching
+    // it from below, or falling below it
+    if (a->has_last && price != a->last_price && a->cross.count > 0) {
+        long long lo = price < a->last_price ? price : a->last_price;
+        long long hi = price < a->last_price ? a->last_price : price;
+        for (int i = bound(&a->cross, lo, 1); i < a->cross.count && a->cross.entries[i].key <= hi; i++) {
+            fire_trade(a->cross.entries[i].rule, id, price, t, a->cross.entries[i].rule->value, recv_us);
+        }
+    }
+    a->last_price = price;
+    a->has_last = 1;
+
+    // Moves compare with the last price at or before the second a window ago, once the history
+    // covers the window
+    if (a->num_moves == 0) return;
+    long long sec = t / 1000;
+    if (!record_history(a, price, sec)) return;
+    for (int j = 0; j < a->num_moves; j++) {
+        MoveGroup *group = &a->moves[j];
+        long long then = sec - group->window;
+        if (then < a->first_sec) continue;
+        long long ref = a->history[then % a->history_size];
+        if (ref <= 0) continue;
+        double move = (price - ref) * 100.0 / ref;
+        group->fired_up = check_edge(&group->up, group->fired_up, move, id, price, t, move, recv_us);
+        group->fired_down = check_edge(&group->down, group->fired_down, -move, id, price, t, move, recv_us);
+    }
+}
+
+// Check the volume rules of a symbol with a finalized window. The volume is compared with the
+// average of the earlier windows with trades in the moving average.
+void alert_candle(int id, const AggCandle *candle) {
+    AlertSymbol *a = &alert_symbols[id];
+    if (a->volume.count == 0 || candle->correction || !candle->has_candle || !candle->has_mov) return;
+    long long earlier = candle->mov_windows - 1;
+    long long earlier_volume = candle->mov_volume - candle->volume;
+    if (earlier < ALERT_MIN_VOLUME_WINDOWS || earlier_volume <= 0) return;
+
+    double multiple = (double)candle->volume * earlier / earlier_volume;
+    long long latency = (current_time_ms() - candle->t) * 1000;
+    for (int i = 0; i < a->volume.count && a->volume.entries[i].key < multiple; i++) {
+        fire(a->volume.entries[i].rule, id, candle->close, candle->t, multiple, latency);
+    }
+}
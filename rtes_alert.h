@@ -0,0 +1,43 @@
+#ifndef RTES_ALERT_H
+#define RTES_ALERT_H
+
+#include "rtes_agg.h"
+#include "rtes_hist.h"
+
+// Longest window of a move rule, the price history kept per symbol is one slot per second of it
+#define ALERT_MAX_MOVE_SEC (60 * 60)
+// Windows with trades before a candle that a volume rule needs to compare it with
+#define ALERT_MIN_VOLUME_WINDOWS 5
+#define ALERT_MAX_RULE 128
+
+enum {
+    ALERT_CROSS,    // the price reaches a level from below or falls below it
+    ALERT_MOVE,     // the price moved by a percentage against the price a window ago
+    ALERT_VOLUME,   // a candlestick's volume is above k times the average of the windows before it
+};
+
+// A rule as written in the rules file, e.g. "AAPL cross 175.50", "* move -2% 5m", "MSFT volume 3x"
+typedef struct {
+    int symbol;             // -1 for every symbol
+    int kind;
+    double value;           // level, percentage or multiple
+    long long window;       // seconds, move rules only
+    char text[ALERT_MAX_RULE];
+} AlertRule;
+
+// Time from receiving the trade that fired an alert until the alert is written, in us
+extern Histogram alert_latency;
+
+// Parse the rules file and compile the rules of every symbol, using the scales set by
+// initialize_json. Alerts are written to out: a file that they are appended to, udp:HOST:PORT, or
+// standard output when out is NULL. Returns the number of rules, or -1 after printing an error.
+int alert_init(const char *rules_path, const char *out);
+
+// Check the trade and move rules of a symbol with one of its trades. Only called by the producer
+// that owns the symbol. Costs a binary search per rule group plus the rules that fire.
+void alert_trade(int id, long long price, long long t, long long recv_us);
+
+// Check the volume rules of a symbol with a finalized window. Only called by its aggregation worker.
+void alert_candle(int id, const AggCandle *candle);
+
+#endif
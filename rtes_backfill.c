@@ -0,0 +1,551 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "rtes_agg.h"
+#include "rtes_store.h"
+#include "rtes_reduce.h"
+#include "json_stream.h"
+
+// Offline recomputation of candlesticks and moving averages from stored trades.
+//
+// The trades of every symbol are replayed through the same aggregator as the live engine, as if
+// each had been received at its exchange timestamp, and written with the same record format.
+// The work is split across cores twice: the trade files are parsed in byte ranges that start at
+// record boundaries, and the windows of every symbol are split into time ranges that are
+// aggregated independently.
+//
+// A time range gives the same windows as a single pass because which trades count is decided up
+// front: a trade counts if its window had not been finalized yet, i.e. if its window ends after
+// the newest earlier timestamp minus the lateness, exactly what the live aggregator decides. Each
+// range starts AGG_MOV_WINDOWS - 1 windows early so its first moving averages are complete,
+// and the windows of the warm-up are not written.
+//
+// Consecutive trades of the same window are read from the trade columns as one run: the
+// vector kernel of rtes_reduce sums their prices and volumes and the run is added to the window
+// in one step. Only the timestamps are compared one by one, to find the run and its open and close.
+
+#define BUFFER_SIZE 1024
+#define MAX_SYMBOLS 512
+#define MAX_THREADS 256
+#define MAX_CANDLES 16
+// Shortest run of trades in one window that is reduced with rtes_reduce rather than added one by one
+#define MIN_RUN 16
+
+static const char record_start[] = "{\"p\": ";
+
+// Backfill options
+typedef struct {
+    const char *input_dir;
+    const char *output_dir;
+    long long from, to;         // windows starting in [from, to) are written
+    long long lateness;         // as the --lateness of rtes
+    long long idle_timeout;
+    int threads;
+    char symbols[MAX_SYMBOLS][BUFFER_SIZE];
+    int num_symbols;
+} BackfillOptions;
+
+// Records of one kind, one per line, appended to the output file in order once all ranges are done
+typedef struct {
+    char *data;
+    size_t len, cap;
+    long long records;
+} Output;
+
+// Trades of one symbol in file order
+typedef struct {
+    const char *map;            // the mapped trade file
+    size_t size;
+    StoreScale scale;
+    int status;
+    size_t chunk_start[MAX_THREADS + 1];    // byte offsets of the parse chunks, at record starts
+    size_t chunk_first[MAX_THREADS + 1];    // index of the first trade of every chunk
+    TradeColumns trades;
+    long long *newest;          // newest timestamp up to and including every trade
+    long long skipped;          // records that could not be parsed
+} SymbolTrades;
+
+// A unit of aggregation work: the windows of one symbol that start in [from, to)
+typedef struct {
+    int symbol;
+    long long from, to;
+    Output cand, mov;
+    long long trades;
+} Range;
+
+static BackfillOptions options;
+static SymbolTrades symbols[MAX_SYMBOLS];
+static Range *ranges;
+static int num_ranges = 0;
+
+// Jobs of the current phase, handed out to the workers in order
+static void (*job_fn)(int);
+static int num_jobs = 0;
+static int next_job = 0;
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// FUnction for the current time
+static long long current_time_ms() {
+    struct timeval time_now;
+    gettimeofday(&time_now, NULL);
+    return (time_now.tv_sec * 1000LL + time_now.tv_usec / 1000); // current time in ms
+}
+
+// Parse a time given either in ms since the epoch or as YYYY-MM-DD[THH:MM[:SS]] in UTC
+static int parse_time(const char *str, long long *out) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int n = sscanf(str, "%d-%d-%d%*[T ]%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n >= 3) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        *out = (long long)timegm(&tm) * 1000LL;
+        return 0;
+    }
+    char *end;
+    *out = strtoll(str, &end, 10);
+    return (end == str || *end != '\0') ? -1 : 0;
+}
+
+// Split a comma separated list of symbols
+static void parse_symbols(char *list) {
+    for (char *tok = strtok(list, ","); tok && options.num_symbols < MAX_SYMBOLS; tok = strtok(NULL, ",")) {
+        snprintf(options.symbols[options.num_symbols++], BUFFER_SIZE, "%s", tok);
+    }
+}
+
+// Use every symbol that has a candlestick file in the input directory
+static void discover_symbols() {
+    DIR *dir = opendir(options.input_dir);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && options.num_symbols < MAX_SYMBOLS) {
+        size_t len = strlen(entry->d_name);
+        if (len > 10 && strcmp(entry->d_name + len - 10, "_cand.json") == 0) {
+            snprintf(options.symbols[options.num_symbols++], BUFFER_SIZE, "%.*s", (int)(len - 10), entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+// Start of the window that contains t
+static long long window_start(long long t) {
+    long long rem = t % AGG_WINDOW_MS;
+    return rem < 0 ? t - rem - AGG_WINDOW_MS : t - rem;
+}
+
+// Run job(0) .. job(n - 1) on the worker threads and wait for all of them
+static void* worker_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        pthread_mutex_lock(&job_mutex);
+        int id = next_job < num_jobs ? next_job++ : -1;
+        pthread_mutex_unlock(&job_mutex);
+        if (id < 0) break;
+        job_fn(id);
+    }
+    return NULL;
+}
+
+static void run_jobs(int n, void (*job)(int)) {
+    job_fn = job;
+    num_jobs = n;
+    next_job = 0;
+    int threads = options.threads < n ? options.threads : n;
+    pthread_t workers[MAX_THREADS];
+    for (int i = 0; i < threads; i++) pthread_create(&workers[i], NULL, worker_thread, NULL);
+    for (int i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+}
+
+// Append one record to an output buffer
+static void output_add(Output *out, const char *record, int len) {
+    if (out->len + len + 1 > out->cap) {
+        size_t cap = out->cap ? out->cap * 2 : 64 * 1024;
+        while (cap < out->len + len + 1) cap *= 2;
+        char *data = realloc(out->data, cap);
+        if (!data) {
+            fprintf(stderr, "[Backfill] Out of memory\n");
+            exit(1);
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+    memcpy(out->data + out->len, record, len);
+    out->len += len;
+    out->data[out->len++] = '\n';
+    out->records++;
+}
+
+// Open and map the trade file of a symbol and read its scale
+static int open_symbol(int s) {
+    SymbolTrades *sym = &symbols[s];
+    char path[2 * BUFFER_SIZE];
+    snprintf(path, sizeof(path), "%s/%s.json", options.input_dir, options.symbols[s]);
+
+    JsonStream *stream = malloc(sizeof(JsonStream));
+    if (!stream || json_stream_open(stream, path) != 0) {
+        fprintf(stderr, "[Backfill] Could not open %s\n", path);
+        free(stream);
+        return -1;
+    }
+    json_stream_next(stream);
+    sym->scale.price = stream->price_scale;
+    sym->scale.volume = stream->volume_scale;
+    json_stream_close(stream);
+    free(stream);
+    if (sym->scale.price < 1 || sym->scale.volume < 1) {
+        fprintf(stderr, "[Backfill] %s has no scale, it was written with decimal values\n", path);
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    sym->size = st.st_size;
+    sym->map = mmap(NULL, sym->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (sym->map == MAP_FAILED) {
+        sym->map = NULL;
+        return -1;
+    }
+    madvise((void *)sym->map, sym->size, MADV_SEQUENTIAL);
+    return 0;
+}
+
+// First record that starts at or after pos, or the end of the file
+static size_t next_record(const SymbolTrades *sym, size_t pos) {
+    const char *found = memmem(sym->map + pos, sym->size - pos, record_start, sizeof(record_start) - 1);
+    return found ? (size_t)(found - sym->map) : sym->size;
+}
+
+// Phase 1: count the records of one chunk of a trade file
+static void count_chunk(int job) {
+    SymbolTrades *sym = &symbols[job / options.threads];
+    int chunk = job % options.threads;
+    if (sym->status != 0) return;
+    size_t count = 0;
+    for (size_t pos = sym->chunk_start[chunk]; (pos = next_record(sym, pos)) < sym->chunk_start[chunk + 1]; pos++) {
+        count++;
+    }
+    sym->chunk_first[chunk + 1] = count;
+}
+
+// Phase 2: parse one chunk into its slice of the columns
+static void parse_chunk(int job) {
+    SymbolTrades *sym = &symbols[job / options.threads];
+    int chunk = job % options.threads;
+    if (sym->status != 0) return;
+    size_t i = sym->chunk_first[chunk];
+    long long skipped = 0;
+    for (size_t pos = sym->chunk_start[chunk]; (pos = next_record(sym, pos)) < sym->chunk_start[chunk + 1]; pos++) {
+        const char *record = sym->map + pos;
+        const char *end = memchr(record, '}', sym->size - pos);
+        size_t len = end ? (size_t)(end - record) + 1 : sym->size - pos;
+        long long t = 0, price = 0, volume = 0;
+        if (!end || json_stream_get_ll(record, len, "t", &t) != 0 || json_stream_get_ll(record, len, "p", &price) != 0 ||
+            json_stream_get_ll(record, len, "v", &volume) != 0) {
+            // Kept in place so the slices stay contiguous, a timestamp of -1 is never aggregated
+            t = -1;
+            skipped++;
+        }
+        sym->trades.t[i] = t;
+        sym->trades.price[i] = price;
+        sym->trades.volume[i] = volume;
+        i++;
+    }
+    __atomic_fetch_add(&sym->skipped, skipped, __ATOMIC_RELAXED);
+}
+
+// Index of the first trade whose newest timestamp so far is at least t
+static size_t first_newest_at(const SymbolTrades *sym, long long t) {
+    size_t lo = 0, hi = sym->trades.len;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sym->newest[mid] < t) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+// Write the finalized windows of a range, the warm-up and windows past the range are skipped
+static void emit(Range *range, const AggCandle *candles, int n) {
+    char record[STORE_MAX_RECORD];
+    for (int i = 0; i < n; i++) {
+        long long start = candles[i].t - AGG_WINDOW_MS;
+        if (start < range->from || start >= range->to) continue;
+        if (candles[i].has_candle) output_add(&range->cand, record, agg_format_candle(record, sizeof(record), &candles[i]));
+        // Backfilled windows were not emitted live, they have no emit delay
+        if (candles[i].has_mov) output_add(&range->mov, record, agg_format_mov(record, sizeof(record), &candles[i], 0));
+    }
+}
+
+// Phase 3: aggregate the trades of one range
+static void aggregate_range(int job) {
+    Range *range = &ranges[job];
+    SymbolTrades *sym = &symbols[range->symbol];
+    const TradeColumns *trades = &sym->trades;
+    long long warmup = range->from - (AGG_MOV_WINDOWS - 1) * AGG_WINDOW_MS;
+
+    // Trades before lo are older than the warm-up. From hi on the newest timestamp has moved so
+    // far past the range that every later trade of the range would be late.
+    size_t lo = first_newest_at(sym, warmup);
+    size_t hi = first_newest_at(sym, range->to + AGG_WINDOW_MS + options.lateness);
+    if (hi < trades->len) hi++;
+
+    Aggregator *agg = malloc(sizeof(Aggregator));
+    if (!agg) return;
+    agg_init(agg, options.lateness, options.idle_timeout, 0);
+    AggCandle candles[MAX_CANDLES];
+    int n;
+    for (size_t i = lo; i < hi;) {
+        long long t = trades->t[i];
+        long long start = window_start(t);
+        // Late in the single pass: the window ended before the watermark of the earlier trades
+        if (t < warmup || t >= range->to || (i > 0 && start + AGG_WINDOW_MS <= sym->newest[i - 1] - options.lateness)) {
+            i++;
+            continue;
+        }
+
+        // The trade is received at its exchange timestamp, which drives the wall clock watermark
+        do {
+            n = agg_advance(agg, t, candles, MAX_CANDLES);
+            emit(range, candles, n);
+        } while (n == MAX_CANDLES);
+        int added = agg_add(agg, t, trades->price[i], trades->volume[i]);
+        range->trades++;
+        i++;
+
+        // The trades that directly follow in the same window count as well, they can't move the
+        // watermark past the end of their own window, and nothing else is finalized before them
+        size_t end = i, first = i, last = i;
+        while (end < hi && trades->t[end] >= start && trades->t[end] < start + AGG_WINDOW_MS) {
+            if (trades->t[end] < trades->t[first]) first = end;
+            if (trades->t[end] >= trades->t[last]) last = end;
+            end++;
+        }
+        if (added == 0 && end - i >= MIN_RUN) {
+            Reduction run;
+            reduce(trades->price + i, trades->volume + i, end - i, &run);
+            agg_add_run(agg, trades->t[first], trades->price[first], trades->t[last], trades->price[last], &run);
+            range->trades += end - i;
+            i = end;
+        }
+        for (; i < end; i++) {
+            do {
+                n = agg_advance(agg, trades->t[i], candles, MAX_CANDLES);
+                emit(range, candles, n);
+            } while (n == MAX_CANDLES);
+            agg_add(agg, trades->t[i], trades->price[i], trades->volume[i]);
+            range->trades++;
+        }
+    }
+
+    // Finalize everything that is left, including the trailing moving averages
+    do {
+        n = agg_advance(agg, range->to + AGG_MOV_WINDOWS * AGG_WINDOW_MS + agg->idle_timeout, candles, MAX_CANDLES);
+        emit(range, candles, n);
+    } while (n == MAX_CANDLES);
+    free(agg);
+}
+
+// Append the buffered records of all ranges of a symbol to a new file
+static int write_output(int s, const char *suffix, const char *type, int cand) {
+    char path[2 * BUFFER_SIZE];
+    snprintf(path, sizeof(path), "%s/%s%s.json", options.output_dir, options.symbols[s], suffix);
+    unlink(path);
+    StoreFile store;
+    if (store_open(&store, path, type, &symbols[s].scale) != 0) return -1;
+    for (int r = 0; r < num_ranges; r++) {
+        if (ranges[r].symbol != s) continue;
+        Output *out = cand ? &ranges[r].cand : &ranges[r].mov;
+        for (size_t pos = 0; pos < out->len;) {
+            char *end = memchr(out->data + pos, '\n', out->len - pos);
+            if (store_append(&store, out->data + pos, end - (out->data + pos)) < 0) {
+                store_close(&store);
+                return -1;
+            }
+            pos = end - out->data + 1;
+        }
+    }
+    store_close(&store);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -i, --input DIR        directory with the <SYMBOL>.json trade files (default .)\n"
+            "  -o, --output DIR       directory for the recomputed <SYMBOL>_cand.json and _mov.json (default backfill)\n"
+            "  -s, --symbols LIST     comma separated symbols (default every <SYMBOL>_cand.json)\n"
+            "      --from TIME        first window, ms or YYYY-MM-DD[THH:MM[:SS]] UTC\n"
+            "      --to TIME          end of the last window (exclusive)\n"
+            "  -l, --lateness MS      allowed lateness, as given to rtes (default %lld)\n"
+            "      --idle-timeout MS  idle timeout, as given to rtes (default %lld)\n"
+            "  -j, --jobs N           worker threads (default number of cores)\n",
+            name, options.lateness, options.idle_timeout);
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"input", required_argument, 0, 'i'},
+        {"output", required_argument, 0, 'o'},
+        {"symbols", required_argument, 0, 's'},
+        {"from", required_argument, 0, 'F'},
+        {"to", required_argument, 0, 'T'},
+        {"lateness", required_argument, 0, 'l'},
+        {"idle-timeout", required_argument, 0, 'I'},
+        {"jobs", required_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    options.input_dir = ".";
+    options.output_dir = "backfill";
+    options.from = -0x3fffffffffffffffLL;
+    options.to = 0x3fffffffffffffffLL;
+    options.lateness = 2000;
+    options.idle_timeout = 10000;
+    options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:o:s:l:j:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i': options.input_dir = optarg; break;
+            case 'o': options.output_dir = optarg; break;
+            case 's': parse_symbols(optarg); break;
+            case 'F':
+                if (parse_time(optarg, &options.from) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 'T':
+                if (parse_time(optarg, &options.to) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 'l': options.lateness = atoll(optarg); break;
+            case 'I': options.idle_timeout = atoll(optarg); break;
+            case 'j': options.threads = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (options.threads < 1) options.threads = 1;
+    if (options.threads > MAX_THREADS) options.threads = MAX_THREADS;
+    if (options.lateness < 0 || options.lateness >= AGG_MAX_AHEAD * AGG_WINDOW_MS) {
+        fprintf(stderr, "[Backfill] Lateness must be between 0 and %lld ms\n", AGG_MAX_AHEAD * AGG_WINDOW_MS - 1);
+        return 1;
+    }
+    if (options.idle_timeout < options.lateness) options.idle_timeout = options.lateness;
+
+    if (options.num_symbols == 0) discover_symbols();
+    if (options.num_symbols == 0) {
+        fprintf(stderr, "[Backfill] No symbols found in %s\n", options.input_dir);
+        return 1;
+    }
+    mkdir(options.output_dir, 0755);
+    long long start = current_time_ms();
+
+    // Split every trade file into one chunk per thread, starting at record boundaries
+    for (int s = 0; s < options.num_symbols; s++) {
+        SymbolTrades *sym = &symbols[s];
+        sym->status = open_symbol(s);
+        if (sym->status != 0) continue;
+        const char *data = memmem(sym->map, sym->size, "\"data\"", 6);
+        size_t begin = data ? (size_t)(data - sym->map) : sym->size;
+        for (int c = 0; c < options.threads; c++) {
+            size_t pos = begin + (sym->size - begin) * c / options.threads;
+            sym->chunk_start[c] = next_record(sym, pos);
+        }
+        sym->chunk_start[options.threads] = sym->size;
+    }
+    run_jobs(options.num_symbols * options.threads, count_chunk);
+
+    // Lay the chunks out one after another and parse them in parallel
+    for (int s = 0; s < options.num_symbols; s++) {
+        SymbolTrades *sym = &symbols[s];
+        if (sym->status != 0) continue;
+        for (int c = 0; c < options.threads; c++) sym->chunk_first[c + 1] += sym->chunk_first[c];
+        size_t total = sym->chunk_first[options.threads];
+        sym->newest = malloc((total + 1) * sizeof(long long));
+        if (!sym->newest || columns_init(&sym->trades, total + 1) != 0) {
+            fprintf(stderr, "[Backfill] Out of memory for %zu %s trades\n", total, options.symbols[s]);
+            return 1;
+        }
+        sym->trades.len = total;
+    }
+    run_jobs(options.num_symbols * options.threads, parse_chunk);
+
+    // Newest timestamps in file order, then one range per thread over the windows of each symbol
+    ranges = calloc((size_t)options.num_symbols * options.threads, sizeof(Range));
+    if (!ranges) return 1;
+    for (int s = 0; s < options.num_symbols; s++) {
+        SymbolTrades *sym = &symbols[s];
+        if (sym->status != 0 || sym->trades.len == 0) continue;
+        long long newest = -1, oldest = 0x3fffffffffffffffLL;
+        for (size_t i = 0; i < sym->trades.len; i++) {
+            long long t = sym->trades.t[i];
+            if (t > newest) newest = t;
+            if (t >= 0 && t < oldest) oldest = t;
+            sym->newest[i] = newest;
+        }
+
+        // The last moving average that includes a trade ends AGG_MOV_WINDOWS windows after it
+        long long from = window_start(oldest - options.lateness);
+        long long to = window_start(newest) + (AGG_MOV_WINDOWS + 1) * AGG_WINDOW_MS;
+        if (options.from > from) from = window_start(options.from + AGG_WINDOW_MS - 1);
+        if (options.to < to) to = window_start(options.to + AGG_WINDOW_MS - 1);
+        long long windows = (to - from) / AGG_WINDOW_MS;
+        if (windows <= 0) continue;
+        int parts = windows < options.threads ? (int)windows : options.threads;
+        for (int p = 0; p < parts; p++) {
+            Range *range = &ranges[num_ranges++];
+            range->symbol = s;
+            range->from = from + windows * p / parts * AGG_WINDOW_MS;
+            range->to = from + windows * (p + 1) / parts * AGG_WINDOW_MS;
+        }
+    }
+    long long parsed = current_time_ms();
+    run_jobs(num_ranges, aggregate_range);
+    long long aggregated = current_time_ms();
+
+    int failed = 0;
+    long long trades = 0, candles = 0, movs = 0;
+    for (int s = 0; s < options.num_symbols; s++) {
+        SymbolTrades *sym = &symbols[s];
+        if (sym->status != 0) {
+            failed++;
+            continue;
+        }
+        if (write_output(s, "_cand", "candlestick", 1) != 0 || write_output(s, "_mov", "moving_average", 0) != 0) {
+            fprintf(stderr, "[Backfill] Could not write the %s files to %s\n", options.symbols[s], options.output_dir);
+            failed++;
+        }
+        long long sym_candles = 0, sym_movs = 0;
+        for (int r = 0; r < num_ranges; r++) {
+            if (ranges[r].symbol != s) continue;
+            sym_candles += ranges[r].cand.records;
+            sym_movs += ranges[r].mov.records;
+        }
+        printf("[Backfill] %s: %zu trades (%lld unreadable), %lld candlesticks, %lld moving averages\n",
+               options.symbols[s], sym->trades.len, sym->skipped, sym_candles, sym_movs);
+        trades += sym->trades.len;
+        candles += sym_candles;
+        movs += sym_movs;
+    }
+    long long elapsed = current_time_ms() - start;
+    printf("[Backfill] %lld trades, %lld candlesticks, %lld moving averages with %d threads in %lld ms "
+           "(parse %lld ms, aggregate %lld ms, write %lld ms), %.0f trades/s\n",
+           trades, candles, movs, options.threads, elapsed, parsed - start, aggregated - parsed,
+           current_time_ms() - aggregated, elapsed > 0 ? trades * 1000.0 / elapsed : 0.0);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,416 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <jansson.h>
+#include "rtes.h"
+#include "rtes_feed.h"
+#include "rtes_metrics.h"
+#include "rtes_reduce.h"
+
+// Microbenchmarks of the ingestion stages, linked against the same code as rtes.
+// Every result is printed as one JSON line so runs of different versions can be compared.
+
+#ifndef RTES_VERSION
+#define RTES_VERSION "unknown"
+#endif
+
+#define FRAME_SIZE (64 * 1024)
+
+// Heap allocations are counted by wrapping malloc at link time (-Wl,--wrap=malloc,...)
+static unsigned long long heap_calls = 0;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_fetch_add(&heap_calls, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size) {
+    __atomic_fetch_add(&heap_calls, 1, __ATOMIC_RELAXED);
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&heap_calls, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static long long trades_per_case = 200000;
+static FILE *results = NULL;
+static const char *only = NULL;
+
+// Hardware cache misses of the process and of the threads it starts, -1 without perf counters
+static int cache_fd = -1;
+
+static void open_cache_counter() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.inherit = 1;
+    cache_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (cache_fd < 0) fprintf(stderr, "[Bench] No hardware cache counters, cache misses are not reported\n");
+}
+
+static long long cache_misses() {
+    long long count;
+    if (cache_fd < 0 || read(cache_fd, &count, sizeof(count)) != sizeof(count)) return -1;
+    return count;
+}
+
+// Whether a group of cases was selected with --only
+static int selected(const char *name) {
+    return !only || strcmp(only, name) == 0;
+}
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Print one result line to stdout and to the results file. misses is -1 when it was not measured.
+static void report(const char *bench, const char *param, long long size, long long trades,
+                   long long elapsed_ns, unsigned long long allocs, long long misses) {
+    char line[512], per_trade[32];
+    if (misses < 0) {
+        snprintf(per_trade, sizeof(per_trade), "null");
+    } else {
+        snprintf(per_trade, sizeof(per_trade), "%.3f", (double)misses / trades);
+    }
+    snprintf(line, sizeof(line),
+             "{\"version\": \"%s\", \"bench\": \"%s\", \"%s\": %lld, \"trades\": %lld, "
+             "\"ns_per_trade\": %.2f, \"allocs_per_trade\": %.4f, \"cache_misses_per_trade\": %s}\n",
+             RTES_VERSION, bench, param, size, trades,
+             (double)elapsed_ns / trades, (double)allocs / trades, per_trade);
+    fputs(line, stdout);
+    if (results) fputs(line, results);
+}
+
+// Build a Finnhub trade message with batch trades, cycling through the symbols
+static int build_frame(char *frame, size_t size, int batch, long long t) {
+    int len = snprintf(frame, size, "{\"data\":[");
+    for (int i = 0; i < batch; i++) {
+        len += snprintf(frame + len, size - len,
+                        "%s{\"c\":[\"1\",\"12\"],\"p\":%.2f,\"s\":\"%s\",\"t\":%lld,\"v\":%d}",
+                        i ? "," : "", 100 + (i % 97) * 0.37, symbol_names[i % NUM_SYMBOLS], t + i, 1 + i % 250);
+    }
+    len += snprintf(frame + len, size - len, "],\"type\":\"trade\"}");
+    return len;
+}
+
+// Take every queued trade off the producer queues
+static void drain_queues() {
+    TradeData trade;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        while (queue_depth(&trade_queues[i]) > 0) queue_pop(&trade_queues[i], &trade);
+    }
+}
+
+// Frame parsing as done by the websocket callback: parse, look up the symbols and queue the
+// trades, which are then taken off the queues again as the producers would
+static void bench_parse(int batch) {
+    char *frame = malloc(FRAME_SIZE);
+    size_t len = build_frame(frame, FRAME_SIZE, batch, 1727788800000LL);
+    long long frames = trades_per_case / batch;
+
+    // Warm up the arena, the queues and stdio before counting
+    handle_frame(FEED_WEBSOCKET, frame, len, 0);
+    drain_queues();
+
+    unsigned long long allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+    long long misses = cache_misses();
+    long long start = now_ns();
+    for (long long i = 0; i < frames; i++) {
+        handle_frame(FEED_WEBSOCKET, frame, len, 0);
+        drain_queues();
+    }
+    long long elapsed = now_ns() - start;
+    if (misses >= 0) misses = cache_misses() - misses;
+    allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED) - allocs;
+
+    report("parse", "batch", batch, frames * batch, elapsed, allocs, misses);
+    free(frame);
+}
+
+// Appending trades to a trade file that already holds history records
+static void bench_persist(long long history) {
+    StoreFile store;
+    const char *path = "bench_trades.json";
+    unlink(path);
+    StoreScale scale = {DEFAULT_PRICE_SCALE, DEFAULT_VOLUME_SCALE};
+    if (store_open(&store, path, "trade", &scale) != 0) {
+        fprintf(stderr, "[Bench] Could not open %s\n", path);
+        exit(1);
+    }
+    long long t = 1727788800000LL;
+    for (long long i = 0; i < history; i++) {
+        add_trade_sample(&store, 2274900, "AAPL", t++, 100000);
+    }
+
+    long long trades = trades_per_case / 10;
+    unsigned long long allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+    long long misses = cache_misses();
+    long long start = now_ns();
+    for (long long i = 0; i < trades; i++) {
+        add_trade_sample(&store, 2274900 + (i % 13) * 100, "AAPL", t++, (1 + i % 250) * 1000);
+    }
+    long long elapsed = now_ns() - start;
+    if (misses >= 0) misses = cache_misses() - misses;
+    allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED) - allocs;
+
+    report("persist", "history", history, trades, elapsed, allocs, misses);
+    store_close(&store);
+    unlink(path);
+}
+
+// Event-time aggregation of a symbol, with the candlesticks and moving averages written out
+// whenever a window is finalized. per_window trades fall into every one minute window.
+static void bench_aggregate(int per_window) {
+    SymbolData *data = &symbols[0];
+    agg_init(&data->agg, config.lateness, config.idle_timeout, config.corrections);
+
+    long long step = AGG_WINDOW_MS / per_window;
+    long long t = 1727788800000LL;
+    unsigned long long allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+    long long misses = cache_misses();
+    long long start = now_ns();
+    for (long long i = 0; i < trades_per_case; i++) {
+        agg_add(&data->agg, t, 2274900 + (i % 13) * 100, (1 + i % 250) * 1000);
+        // The event time stands in for the wall clock, as if trades arrived without delay
+        if (agg_ready(&data->agg)) process_trades(data, t);
+        t += step;
+    }
+    long long elapsed = now_ns() - start;
+    if (misses >= 0) misses = cache_misses() - misses;
+    allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED) - allocs;
+
+    report("aggregate", "per_window", per_window, trades_per_case, elapsed, allocs, misses);
+}
+
+// Window reduction (min, max, sum, volume and vwap) over n trades, with the scalar loop and with
+// the vector kernel of this CPU
+static void bench_reduce(long long n) {
+    TradeColumns cols;
+    if (columns_init(&cols, n) != 0) {
+        fprintf(stderr, "[Bench] Could not allocate %lld trades\n", n);
+        exit(1);
+    }
+    long long price = 2274900;
+    for (long long i = 0; i < n; i++) {
+        price += ((i * 7919) % 21 - 10) * 100;
+        columns_push(&cols, 1727788800000LL + i, price, (1 + i % 250) * 1000);
+    }
+
+    const char *name;
+    ReduceFn kernels[2] = {reduce_scalar, reduce_best(&name)};
+    const char *names[2] = {"reduce_scalar", NULL};
+    char best[64];
+    snprintf(best, sizeof(best), "reduce_%s", name);
+    names[1] = best;
+
+    // Repeat small windows so every case reduces about the same number of trades
+    long long reps = trades_per_case * 20 / n;
+    if (reps < 1) reps = 1;
+    Reduction result[2];
+    for (int k = 0; k < 2; k++) {
+        volatile long long sink = 0;
+        unsigned long long allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+        long long misses = cache_misses();
+        long long start = now_ns();
+        for (long long r = 0; r < reps; r++) {
+            kernels[k](cols.price, cols.volume, cols.len, &result[k]);
+            sink += result[k].pv;
+        }
+        long long elapsed = now_ns() - start;
+        if (misses >= 0) misses = cache_misses() - misses;
+        allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED) - allocs;
+        report(names[k], "window", n, reps * n, elapsed, allocs, misses);
+    }
+
+    // Integer sums do not depend on the order of the additions, the results must be identical
+    if (memcmp(&result[0], &result[1], sizeof(Reduction)) != 0) {
+        fprintf(stderr, "[Bench] %s result differs from the scalar loop\n", best);
+    }
+    columns_free(&cols);
+}
+
+// Dedup lookups over a stream of 4 trades per ms in which one trade in ten is a copy of a trade
+// received 100 trades earlier, with a set of the given capacity and a 60 s window
+static void bench_dedup(long long capacity) {
+    DedupSet set;
+    if (dedup_init(&set, capacity, 60000) != 0) return;
+    long long t = 1727788800000LL, copies = 0;
+
+    unsigned long long allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+    long long misses = cache_misses();
+    long long start = now_ns();
+    for (long long i = 0; i < trades_per_case; i++) {
+        long long k = i % 10 == 9 && i >= 100 ? i - 100 : i;
+        copies += dedup_check(&set, k % NUM_SYMBOLS, t + k / 4, 2274900 + (k % 13) * 100, (1 + k % 250) * 1000, 0, i);
+    }
+    long long elapsed = now_ns() - start;
+    if (misses >= 0) misses = cache_misses() - misses;
+    allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED) - allocs;
+
+    if (copies != trades_per_case / 10 - 10) {
+        fprintf(stderr, "[Bench] dedup found %lld copies instead of %lld\n", copies, trades_per_case / 10 - 10);
+    }
+    report("dedup", "capacity", capacity, trades_per_case, elapsed, allocs, misses);
+    dedup_free(&set);
+}
+
+// The whole ingestion path with the real producer and aggregation threads: frames are parsed on
+// this thread as on the websocket thread, and the producers store and aggregate the trades
+// concurrently. This is where symbols shared between cores would show up as cache misses.
+// The queues are closed at the end, so this case has to run last.
+static void bench_pipeline(int batch) {
+    char *frame = malloc(FRAME_SIZE);
+    // Current timestamps keep every trade in an open window, as in live trading
+    size_t len = build_frame(frame, FRAME_SIZE, batch, current_time_ms());
+    long long frames = trades_per_case / batch;
+    pthread_t producers[NUM_THREADS], aggregators[MAX_AGG_WORKERS];
+
+    config.quiet = 1;
+    unsigned long long allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED);
+    long long misses = cache_misses();
+    long long start = now_ns();
+    for (int i = 0; i < NUM_THREADS; i++) {
+        int *id = malloc(sizeof(int));
+        *id = i;
+        rt_thread_create(&config.rt, RT_ROLE_WRITER, &producers[i], producer_thread, id);
+    }
+    for (int i = 0; i < config.agg_workers; i++) {
+        int *id = malloc(sizeof(int));
+        *id = i;
+        rt_thread_create(&config.rt, RT_ROLE_AGG, &aggregators[i], aggregator_thread, id);
+    }
+    for (long long i = 0; i < frames; i++) {
+        // Back off instead of dropping trades when a producer falls behind
+        for (int q = 0; q < NUM_THREADS; q++) {
+            while (queue_depth(&trade_queues[q]) + batch > trade_queues[q].capacity) sched_yield();
+        }
+        handle_frame(FEED_WEBSOCKET, frame, len, 0);
+    }
+    for (int i = 0; i < NUM_THREADS; i++) queue_close(&trade_queues[i]);
+    for (int i = 0; i < NUM_THREADS; i++) pthread_join(producers[i], NULL);
+    long long elapsed = now_ns() - start;
+
+    drained_flag = 1;
+    agg_workers_wake();
+    for (int i = 0; i < config.agg_workers; i++) pthread_join(aggregators[i], NULL);
+    if (misses >= 0) misses = cache_misses() - misses;
+    allocs = __atomic_load_n(&heap_calls, __ATOMIC_RELAXED) - allocs;
+
+    report("pipeline", "batch", batch, frames * batch, elapsed, allocs, misses);
+    free(frame);
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [options]\n"
+           "  -n, --trades N     trades per benchmark case (default %lld)\n"
+           "  -o, --output FILE  also append the JSON lines to FILE\n"
+           "  -d, --dir DIR      directory for the temporary JSON files (default /tmp)\n"
+           "      --only NAME    run one group: parse, persist, aggregate, reduce, dedup or pipeline\n"
+           "  -h, --help         show this help\n", prog, trades_per_case);
+}
+
+int main(int argc, char **argv) {
+    const char *output = NULL;
+    const char *dir = "/tmp";
+    static struct option long_options[] = {
+        {"trades", required_argument, 0, 'n'},
+        {"output", required_argument, 0, 'o'},
+        {"dir", required_argument, 0, 'd'},
+        {"only", required_argument, 0, 'O'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    rt_config_init(&config.rt);
+    while ((opt = getopt_long(argc, argv, "n:o:d:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'n': trades_per_case = atoll(optarg); break;
+            case 'o': output = optarg; break;
+            case 'd': dir = optarg; break;
+            case 'O': only = optarg; break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (trades_per_case < 1000) trades_per_case = 1000;
+
+    if (output && !(results = fopen(output, "a"))) {
+        perror(output);
+        return 1;
+    }
+
+    // Work in a scratch directory so the symbol files of a live instance are not touched
+    char workdir[BUFFER_SIZE];
+    snprintf(workdir, sizeof(workdir), "%s/rtes-bench-XXXXXX", dir);
+    if (!mkdtemp(workdir) || chdir(workdir) != 0) {
+        perror(workdir);
+        return 1;
+    }
+
+    // Same setup as rtes, the threads are only started by the pipeline case
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (queue_init(&trade_queues[i], config.queue_size, sizeof(TradeData)) != 0) {
+            fprintf(stderr, "[Bench] Could not allocate the trade queues\n");
+            return 1;
+        }
+    }
+    if (arena_init(&frame_arena, config.arena_size) != 0 || dedup_sets_init() != 0) {
+        fprintf(stderr, "[Bench] Could not allocate the frame arena or the dedup sets\n");
+        return 1;
+    }
+    json_set_alloc_funcs(arena_malloc, arena_free);
+    metrics_init(NUM_SYMBOLS, symbol_names);
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        initialize_json(symbol_names[i], &symbols[i]);
+    }
+    agg_workers_init();
+    fflush(stdout);
+    open_cache_counter();
+
+    int batches[] = {1, 10, 100};
+    for (int i = 0; i < 3 && selected("parse"); i++) bench_parse(batches[i]);
+
+    long long histories[] = {0, 10000, 100000};
+    for (int i = 0; i < 3 && selected("persist"); i++) bench_persist(histories[i]);
+
+    int per_window[] = {10, 100, 1000};
+    for (int i = 0; i < 3 && selected("aggregate"); i++) bench_aggregate(per_window[i]);
+
+    long long windows[] = {1000, 65536, 1 << 20};
+    for (int i = 0; i < 3 && selected("reduce"); i++) bench_reduce(windows[i]);
+
+    long long capacities[] = {1 << 14, 1 << 17, 1 << 20};
+    for (int i = 0; i < 3 && selected("dedup"); i++) bench_dedup(capacities[i]);
+
+    if (selected("pipeline")) bench_pipeline(10);
+
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        store_close(&symbols[i].trade_store);
+        store_close(&symbols[i].cand_store);
+        store_close(&symbols[i].mov_store);
+        unlink(symbol_info[i].trade_file);
+        unlink(symbol_info[i].cand_file);
+        unlink(symbol_info[i].mov_file);
+    }
+    if (chdir("/") == 0) rmdir(workdir);
+    if (results) fclose(results);
+    return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rtes_dedup.h"
+
+// Fingerprints of seeded trades are salted, so they match any conditions but never a fingerprint
+// that includes conditions
+#define SEED_SALT 0x5bd1e9955bd1e995ULL
+
+// Frame tag 0 is reserved for seeded trades
+#define TAG_MASK ((1ULL << DEDUP_TAG_BITS) - 1)
+#define FRAME_TAG(frame) ((unsigned long long)(frame) % TAG_MASK + 1)
+
+static inline unsigned long long mix(unsigned long long x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+static inline unsigned long long nonzero(unsigned long long key) {
+    return key ? key : 1;
+}
+
+// Allocate the buckets
+int dedup_init(DedupSet *set, size_t capacity, long long window_ms) {
+    memset(set, 0, sizeof(DedupSet));
+    if (capacity == 0 || window_ms <= 0) return 0;
+    size_t buckets = 1;
+    while (buckets * DEDUP_WAYS < capacity) buckets <<= 1;
+    set->buckets = aligned_alloc(64, buckets * sizeof(DedupEntry) * DEDUP_WAYS);
+    if (!set->buckets) return -1;
+    memset(set->buckets, 0, buckets * sizeof(DedupEntry) * DEDUP_WAYS);
+    set->mask = buckets - 1;
+    set->window = window_ms;
+    return 0;
+}
+
+void dedup_free(DedupSet *set) {
+    free(set->buckets);
+    memset(set, 0, sizeof(DedupSet));
+}
+
+// FNV-1a over the code and a separator
+unsigned dedup_hash_condition(unsigned hash, const char *condition) {
+    if (!hash) hash = 2166136261u;
+    for (const char *c = condition; c && *c; c++) hash = (hash ^ (unsigned char)*c) * 16777619u;
+    return (hash ^ ',') * 16777619u;
+}
+
+// Put key into its bucket: into an empty or expired slot, otherwise over the oldest trade
+static void insert(DedupSet *set, DedupEntry *bucket, unsigned long long key, unsigned long long stamp) {
+    long long expired = set->newest - set->window;
+    DedupEntry *slot = &bucket[0];
+    for (int i = 0; i < DEDUP_WAYS; i++) {
+        if (bucket[i].key == 0 || (long long)(bucket[i].stamp >> DEDUP_TAG_BITS) < expired) {
+            slot = &bucket[i];
+            break;
+        }
+        if (bucket[i].stamp < slot->stamp) slot = &bucket[i];
+    }
+    if (slot->key != 0 && (long long)(slot->stamp >> DEDUP_TAG_BITS) >= expired) set->evictions++;
+    slot->key = key;
+    slot->stamp = stamp;
+}
+
+// Check a trade and remember it
+int dedup_check(DedupSet *set, int symbol, long long timestamp, long long price, long long volume,
+                unsigned conditions, unsigned long long frame) {
+    if (!set->buckets) return 0;
+    if (timestamp > set->newest) set->newest = timestamp;
+
+    unsigned long long base = mix(mix(mix((unsigned long long)symbol << 48 ^ timestamp) ^ price) ^ volume);
+    unsigned long long key = nonzero(mix(base ^ conditions));
+    unsigned long long seeded = nonzero(base ^ SEED_SALT);
+    unsigned long long tag = FRAME_TAG(frame);
+    DedupEntry *bucket = &set->buckets[(base & set->mask) * DEDUP_WAYS];
+    long long expired = set->newest - set->window;
+
+    for (int i = 0; i < DEDUP_WAYS; i++) {
+        if ((bucket[i].key == key || bucket[i].key == seeded) && (long long)(bucket[i].stamp >> DEDUP_TAG_BITS) >= expired) {
+            if ((bucket[i].stamp & TAG_MASK) == tag) return 0;
+            set->duplicates++;
+            return 1;
+        }
+    }
+    insert(set, bucket, key, (unsigned long long)timestamp << DEDUP_TAG_BITS | tag);
+    return 0;
+}
+
+// Remember a stored trade without conditions
+void dedup_seed(DedupSet *set, int symbol, long long timestamp, long long price, long long volume) {
+    if (!set->buckets) return;
+    if (timestamp > set->newest) set->newest = timestamp;
+    unsigned long long base = mix(mix(mix((unsigned long long)symbol << 48 ^ timestamp) ^ price) ^ volume);
+    insert(set, &set->buckets[(base & set->mask) * DEDUP_WAYS], nonzero(base ^ SEED_SALT),
+           (unsigned long long)timestamp << DEDUP_TAG_BITS);
+}
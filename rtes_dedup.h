@@ -0,0 +1,52 @@
+#ifndef RTES_DEDUP_H
+#define RTES_DEDUP_H
+
+#include <stddef.h>
+
+// Entries per bucket, one 64 byte cache line
+#define DEDUP_WAYS 4
+
+// Bits of DedupEntry.stamp that tag the frame a trade arrived in. The other 42 bits hold the
+// timestamp in ms, enough until the year 2109. Frames are told apart as long as fewer than 4
+// million frames are received within the window.
+#define DEDUP_TAG_BITS 22
+
+// A stored trade: a 64 bit fingerprint of (symbol, timestamp, price, volume, conditions) and its
+// timestamp, with the low DEDUP_TAG_BITS bits holding a tag of the frame it arrived in
+typedef struct {
+    unsigned long long key;     // 0 marks an empty slot
+    unsigned long long stamp;   // timestamp << DEDUP_TAG_BITS | frame tag
+} DedupEntry;
+
+// Time-windowed hash set of recent trades. Memory is allocated once; a trade is remembered until
+// it is window ms older than the newest trade, or until its bucket is full and it is the oldest
+// in it. A lookup reads a single bucket, so checking a trade costs O(1).
+typedef struct {
+    DedupEntry *buckets;
+    size_t mask;                // buckets - 1
+    long long window;
+    long long newest;           // newest timestamp seen
+    unsigned long long duplicates;  // trades recognized as duplicates
+    unsigned long long evictions;   // trades forgotten before their window ended, the set is too small
+} DedupSet;
+
+// Allocate room for capacity trades (rounded up to a power of two). A window of 0 or a capacity
+// of 0 disables the set. Returns 0 on success.
+int dedup_init(DedupSet *set, size_t capacity, long long window_ms);
+
+void dedup_free(DedupSet *set);
+
+// Fold one condition code into a hash of a trade's conditions
+unsigned dedup_hash_condition(unsigned hash, const char *condition);
+
+// Check a trade and remember it. frame is the sequence number of the frame the trade was parsed
+// from (see TradeData.frame): a trade seen again in the same frame is a separate trade with
+// identical fields, not a copy. Returns 1 if the trade was seen before and is a duplicate, 0 otherwise.
+int dedup_check(DedupSet *set, int symbol, long long timestamp, long long price, long long volume,
+                unsigned conditions, unsigned long long frame);
+
+// Remember a trade that was stored before a restart. Its conditions are not stored, so it matches
+// a trade with any conditions.
+void dedup_seed(DedupSet *set, int symbol, long long timestamp, long long price, long long volume);
+
+#endif
@@ -0,0 +1,397 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "json_stream.h"
+
+#define BUFFER_SIZE 1024
+#define MAX_SYMBOLS 512
+#define MAX_COLUMNS 6
+#define NPY_HEADER_SIZE 128
+
+// Kinds of stored data that can be exported
+enum { KIND_TRADES, KIND_CANDLES, KIND_MOV, NUM_KINDS };
+
+static const char *kind_names[NUM_KINDS] = {"trades", "candles", "mov"};
+static const char *kind_suffix[NUM_KINDS] = {"", "_cand", "_mov"};
+
+// Columns of every kind, in output order. The first column is always the timestamp.
+static const char *kind_columns[NUM_KINDS][MAX_COLUMNS] = {
+    {"t", "p", "v", NULL},
+    {"t", "open", "high", "low", "close", "v"},
+    {"t", "p", "v", "d", NULL},
+};
+
+// Scale of every column: 'p' for prices, 'v' for volumes and 0 for values that are not scaled
+static const char kind_units[NUM_KINDS][MAX_COLUMNS] = {
+    {0, 'p', 'v'},
+    {0, 'p', 'p', 'p', 'p', 'v'},
+    {0, 'p', 'v', 0},
+};
+
+// Export options
+typedef struct {
+    const char *input_dir;
+    const char *output_dir;
+    int npy;                    // write .npy columns instead of csv
+    int kinds[NUM_KINDS];
+    long long from, to;         // inclusive time range in ms
+    int threads;
+    char symbols[MAX_SYMBOLS][BUFFER_SIZE];
+    int num_symbols;
+} ExportOptions;
+
+// A unit of work: one kind of one symbol
+typedef struct {
+    int symbol;
+    int kind;
+    long long rows;
+    long long scanned;
+    long long bytes;
+    long long elapsed;
+    int status;
+} ExportJob;
+
+static ExportOptions options;
+static ExportJob jobs[MAX_SYMBOLS * NUM_KINDS];
+static int num_jobs = 0;
+static int next_job = 0;
+static pthread_mutex_t job_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// FUnction for the current time
+static long long current_time_ms() {
+    struct timeval time_now;
+    gettimeofday(&time_now, NULL);
+    return (time_now.tv_sec * 1000LL + time_now.tv_usec / 1000); // current time in ms
+}
+
+// Parse a time given either in ms since the epoch or as YYYY-MM-DD[THH:MM[:SS]] in UTC
+static int parse_time(const char *str, long long *out) {
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int n = sscanf(str, "%d-%d-%d%*[T ]%d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (n >= 3) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        *out = (long long)timegm(&tm) * 1000LL;
+        return 0;
+    }
+    char *end;
+    *out = strtoll(str, &end, 10);
+    return (end == str || *end != '\0') ? -1 : 0;
+}
+
+// Split a comma separated list of symbols
+static void parse_symbols(char *list) {
+    for (char *tok = strtok(list, ","); tok && options.num_symbols < MAX_SYMBOLS; tok = strtok(NULL, ",")) {
+        snprintf(options.symbols[options.num_symbols++], BUFFER_SIZE, "%s", tok);
+    }
+}
+
+// Select the kinds of a comma separated list, returns -1 on an unknown kind
+static int parse_kinds(char *list) {
+    for (int k = 0; k < NUM_KINDS; k++) options.kinds[k] = 0;
+    char *save;
+    for (char *tok = strtok_r(list, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        int kind = -1;
+        for (int k = 0; k < NUM_KINDS; k++) {
+            if (strcmp(tok, kind_names[k]) == 0) kind = k;
+        }
+        if (kind < 0) return -1;
+        options.kinds[kind] = 1;
+    }
+    return 0;
+}
+
+// Use every symbol that has a candlestick file in the input directory
+static void discover_symbols() {
+    DIR *dir = opendir(options.input_dir);
+    if (!dir) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && options.num_symbols < MAX_SYMBOLS) {
+        size_t len = strlen(entry->d_name);
+        if (len > 10 && strcmp(entry->d_name + len - 10, "_cand.json") == 0) {
+            snprintf(options.symbols[options.num_symbols++], BUFFER_SIZE, "%.*s", (int)(len - 10), entry->d_name);
+        }
+    }
+    closedir(dir);
+}
+
+// Write a version 1.0 .npy header for a one dimensional array. The header has a fixed size so it
+// can be rewritten with the final row count once the column is complete.
+static void write_npy_header(FILE *file, const char *descr, long long rows) {
+    char header[NPY_HEADER_SIZE];
+    memset(header, ' ', sizeof(header));
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = (NPY_HEADER_SIZE - 10) & 0xff;
+    header[9] = ((NPY_HEADER_SIZE - 10) >> 8) & 0xff;
+    int n = snprintf(header + 10, NPY_HEADER_SIZE - 10, "{'descr': '%s', 'fortran_order': False, 'shape': (%lld,), }",
+                     descr, rows);
+    header[10 + n] = ' ';
+    header[NPY_HEADER_SIZE - 1] = '\n';
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), file);
+}
+
+// Format a value of ticks as a decimal. Power of ten scales are printed exactly.
+static void format_ticks(char *buf, size_t size, long long ticks, long long scale) {
+    int digits = 0;
+    long long p = 1;
+    while (p < scale && digits < 18) {
+        p *= 10;
+        digits++;
+    }
+    if (p != scale) {
+        snprintf(buf, size, "%.17g", (double)ticks / scale);
+        return;
+    }
+    unsigned long long magnitude = ticks < 0 ? -(unsigned long long)ticks : (unsigned long long)ticks;
+    unsigned long long frac = magnitude % scale;
+    while (digits > 0 && frac % 10 == 0) {
+        frac /= 10;
+        digits--;
+    }
+    if (digits > 0) {
+        snprintf(buf, size, "%s%llu.%0*llu", ticks < 0 ? "-" : "", magnitude / scale, digits, frac);
+    } else {
+        snprintf(buf, size, "%s%llu", ticks < 0 ? "-" : "", magnitude / scale);
+    }
+}
+
+// Export one kind of one symbol, streaming record by record
+static void export_job(ExportJob *job, JsonStream *stream) {
+    const char *symbol = options.symbols[job->symbol];
+    const char **columns = kind_columns[job->kind];
+    int num_columns = 0;
+    while (num_columns < MAX_COLUMNS && columns[num_columns]) num_columns++;
+
+    char path[BUFFER_SIZE + 32];
+    snprintf(path, sizeof(path), "%s/%s%s.json", options.input_dir, symbol, kind_suffix[job->kind]);
+    if (json_stream_open(stream, path) != 0) {
+        fprintf(stderr, "[Export] Could not open %s\n", path);
+        job->status = -1;
+        return;
+    }
+
+    // Open the outputs, one csv file or one .npy file per column
+    FILE *out[MAX_COLUMNS] = {NULL};
+    int num_out = options.npy ? num_columns : 1;
+    for (int i = 0; i < num_out; i++) {
+        if (options.npy) {
+            snprintf(path, sizeof(path), "%s/%s_%s.%s.npy", options.output_dir, symbol, kind_names[job->kind], columns[i]);
+        } else {
+            snprintf(path, sizeof(path), "%s/%s_%s.csv", options.output_dir, symbol, kind_names[job->kind]);
+        }
+        out[i] = fopen(path, "w");
+        if (!out[i]) {
+            fprintf(stderr, "[Export] Could not create %s\n", path);
+            for (int j = 0; j < i; j++) fclose(out[j]);
+            json_stream_close(stream);
+            job->status = -1;
+            return;
+        }
+        if (options.npy) {
+            write_npy_header(out[i], i == 0 ? "<i8" : "<f8", 0);
+        } else {
+            for (int j = 0; j < num_columns; j++) {
+                fprintf(out[i], j == 0 ? "%s" : ",%s", columns[j]);
+            }
+            fputc('\n', out[i]);
+        }
+    }
+
+    long long start = current_time_ms();
+    int result;
+    while ((result = json_stream_next(stream)) == 1) {
+        job->scanned++;
+        long long t;
+        if (json_stream_get_ll(stream->object, stream->object_len, "t", &t) != 0) continue;
+        if (t < options.from || t > options.to) continue;
+
+        // Prices and volumes are stored as ticks and only become decimals here. Files written
+        // before the scale header hold decimal values and are passed through as they are.
+        double values[MAX_COLUMNS] = {0};
+        long long ticks[MAX_COLUMNS] = {0};
+        long long scales[MAX_COLUMNS] = {0};
+        for (int i = 1; i < num_columns; i++) {
+            if (kind_units[job->kind][i] == 'p') scales[i] = stream->price_scale;
+            if (kind_units[job->kind][i] == 'v') scales[i] = stream->volume_scale;
+            if (scales[i] > 0) {
+                json_stream_get_ll(stream->object, stream->object_len, columns[i], &ticks[i]);
+                values[i] = (double)ticks[i] / scales[i];
+            } else {
+                json_stream_get_double(stream->object, stream->object_len, columns[i], &values[i]);
+            }
+        }
+
+        if (options.npy) {
+            fwrite(&t, sizeof(t), 1, out[0]);
+            for (int i = 1; i < num_columns; i++) {
+                fwrite(&values[i], sizeof(values[i]), 1, out[i]);
+            }
+        } else {
+            char decimal[64];
+            fprintf(out[0], "%lld", t);
+            for (int i = 1; i < num_columns; i++) {
+                if (scales[i] > 0) {
+                    format_ticks(decimal, sizeof(decimal), ticks[i], scales[i]);
+                    fprintf(out[0], ",%s", decimal);
+                } else {
+                    fprintf(out[0], ",%.17g", values[i]);
+                }
+            }
+            fputc('\n', out[0]);
+        }
+        job->rows++;
+    }
+    if (result < 0) {
+        fprintf(stderr, "[Export] Read error in %s%s.json\n", symbol, kind_suffix[job->kind]);
+        job->status = -1;
+    }
+    if (stream->skipped > 0) {
+        fprintf(stderr, "[Export] Skipped %lld oversized records in %s%s.json\n", stream->skipped, symbol, kind_suffix[job->kind]);
+    }
+
+    for (int i = 0; i < num_out; i++) {
+        if (options.npy) write_npy_header(out[i], i == 0 ? "<i8" : "<f8", job->rows);
+        fseek(out[i], 0, SEEK_END);
+        job->bytes += ftell(out[i]);
+        fclose(out[i]);
+    }
+    json_stream_close(stream);
+    job->elapsed = current_time_ms() - start;
+}
+
+// Worker thread, takes jobs until none are left
+static void* export_thread(void* arg) {
+    // Each worker owns one stream, memory use is constant regardless of file sizes
+    JsonStream *stream = malloc(sizeof(JsonStream));
+    if (!stream) return NULL;
+    (void)arg;
+
+    while (1) {
+        pthread_mutex_lock(&job_mutex);
+        int id = next_job < num_jobs ? next_job++ : -1;
+        pthread_mutex_unlock(&job_mutex);
+        if (id < 0) break;
+
+        export_job(&jobs[id], stream);
+        printf("[Export] %s %s: %lld of %lld rows, %lld bytes in %lld ms\n",
+               options.symbols[jobs[id].symbol], kind_names[jobs[id].kind],
+               jobs[id].rows, jobs[id].scanned, jobs[id].bytes, jobs[id].elapsed);
+    }
+    free(stream);
+    return NULL;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -i, --input DIR      directory with the <SYMBOL>*.json files (default .)\n"
+            "  -o, --output DIR     output directory (default .)\n"
+            "  -f, --format FMT     csv or npy (default csv)\n"
+            "  -k, --kinds LIST     comma separated trades,candles,mov (default all)\n"
+            "  -s, --symbols LIST   comma separated symbols (default every <SYMBOL>_cand.json)\n"
+            "      --from TIME      first timestamp, ms or YYYY-MM-DD[THH:MM[:SS]] UTC\n"
+            "      --to TIME        last timestamp, ms or YYYY-MM-DD[THH:MM[:SS]] UTC\n"
+            "  -j, --jobs N         worker threads (default number of cores)\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"input", required_argument, 0, 'i'},
+        {"output", required_argument, 0, 'o'},
+        {"format", required_argument, 0, 'f'},
+        {"kinds", required_argument, 0, 'k'},
+        {"symbols", required_argument, 0, 's'},
+        {"from", required_argument, 0, 'F'},
+        {"to", required_argument, 0, 'T'},
+        {"jobs", required_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    options.input_dir = ".";
+    options.output_dir = ".";
+    options.from = 0;
+    options.to = 0x7fffffffffffffffLL;
+    options.threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    for (int k = 0; k < NUM_KINDS; k++) options.kinds[k] = 1;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:o:f:k:s:j:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 'i': options.input_dir = optarg; break;
+            case 'o': options.output_dir = optarg; break;
+            case 'f':
+                if (strcmp(optarg, "npy") == 0) options.npy = 1;
+                else if (strcmp(optarg, "csv") == 0) options.npy = 0;
+                else { usage(argv[0]); return 1; }
+                break;
+            case 'k':
+                if (parse_kinds(optarg) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 's': parse_symbols(optarg); break;
+            case 'F':
+                if (parse_time(optarg, &options.from) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 'T':
+                if (parse_time(optarg, &options.to) != 0) { usage(argv[0]); return 1; }
+                break;
+            case 'j': options.threads = atoi(optarg); break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (options.threads < 1) options.threads = 1;
+
+    if (options.num_symbols == 0) discover_symbols();
+    if (options.num_symbols == 0) {
+        fprintf(stderr, "[Export] No symbols found in %s\n", options.input_dir);
+        return 1;
+    }
+    mkdir(options.output_dir, 0755);
+
+    // One job per symbol and kind, handed out to the workers in order
+    for (int i = 0; i < options.num_symbols; i++) {
+        for (int k = 0; k < NUM_KINDS; k++) {
+            if (!options.kinds[k]) continue;
+            memset(&jobs[num_jobs], 0, sizeof(ExportJob));
+            jobs[num_jobs].symbol = i;
+            jobs[num_jobs].kind = k;
+            num_jobs++;
+        }
+    }
+    if (num_jobs == 0) {
+        fprintf(stderr, "[Export] Nothing to export, --kinds must name at least one of trades, candles, mov\n");
+        return 1;
+    }
+    if (options.threads > num_jobs) options.threads = num_jobs;
+
+    long long start = current_time_ms();
+    pthread_t threads[options.threads];
+    for (int i = 0; i < options.threads; i++) {
+        pthread_create(&threads[i], NULL, export_thread, NULL);
+    }
+    for (int i = 0; i < options.threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    long long rows = 0, bytes = 0;
+    int failed = 0;
+    for (int i = 0; i < num_jobs; i++) {
+        rows += jobs[i].rows;
+        bytes += jobs[i].bytes;
+        if (jobs[i].status != 0) failed++;
+    }
+    printf("[Export] %lld rows, %lld bytes from %d files with %d threads in %lld ms\n",
+           rows, bytes, num_jobs, options.threads, current_time_ms() - start);
+    return failed ? 1 : 0;
+}
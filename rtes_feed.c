@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "rtes_feed.h"
+#include "rtes_metrics.h"
+
+Feed feeds[MAX_FEEDS] = {
+    {.name = "websocket", .arena = &frame_arena},
+};
+int num_feeds = 1;
+long long merge_delay_ms = 50;
+
+// Trades waiting to be merged, a binary min-heap ordered by timestamp
+static TradeData *heap = NULL;
+static size_t heap_len = 0, heap_cap = 0;
+static pthread_mutex_t merge_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t merge_cond;
+static pthread_t merger;
+
+// The last trades of every symbol that left the merge, to recognize copies from other feeds
+typedef struct {
+    long long timestamp, price, volume;
+    long long recv_us;
+    unsigned seen;      // feeds that delivered this trade
+} RecentTrade;
+
+static RecentTrade recent[NUM_SYMBOLS][FEED_RECENT];
+static int recent_next[NUM_SYMBOLS];
+
+// Add a feed that replays recorded messages
+int feed_add_replay(const char *path, double speed) {
+    if (num_feeds == MAX_FEEDS) return -1;
+    Feed *feed = &feeds[num_feeds];
+    feed->name = path;
+    feed->path = path;
+    feed->speed = speed;
+    return num_feeds++;
+}
+
+static int trade_before(const TradeData *a, const TradeData *b) {
+    if (a->timestamp != b->timestamp) return a->timestamp < b->timestamp;
+    return a->recv_us < b->recv_us;
+}
+
+static void heap_push(const TradeData *trade) {
+    size_t i = heap_len++;
+    while (i > 0 && trade_before(trade, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = *trade;
+}
+
+static void heap_pop(TradeData *trade) {
+    *trade = heap[0];
+    TradeData last = heap[--heap_len];
+    size_t i = 0;
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= heap_len) break;
+        if (child + 1 < heap_len && trade_before(&heap[child + 1], &heap[child])) child++;
+        if (!trade_before(&heap[child], &last)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+}
+
+// Newest timestamp that no feed which is still sending will deliver again. Feeds are not in
+// timestamp order (Finnhub frames are not), but a trade more than the allowed lateness behind the
+// newest trade of its feed is late for the aggregator anyway, so that is the bound a feed is held to.
+static long long merge_frontier() {
+    long long frontier = LLONG_MAX;
+    for (int i = 0; i < num_feeds; i++) {
+        if (!feeds[i].done && feeds[i].latest - config.lateness < frontier) frontier = feeds[i].latest - config.lateness;
+    }
+    return frontier;
+}
+
+// Whether another feed already delivered this trade. A feed that sends the same trade twice
+// keeps both, only copies from different feeds are duplicates.
+static int is_duplicate(const TradeData *trade) {
+    RecentTrade *list = recent[trade->id];
+    unsigned bit = 1u << trade->feed;
+    for (int i = 0; i < FEED_RECENT; i++) {
+        RecentTrade *r = &list[i];
+        if (r->timestamp == trade->timestamp && r->price == trade->price && r->volume == trade->volume &&
+            !(r->seen & bit)) {
+            r->seen |= bit;
+            hist_record(&feeds[trade->feed].lag, trade->recv_us - r->recv_us);
+            return 1;
+        }
+    }
+    RecentTrade *r = &list[recent_next[trade->id]];
+    recent_next[trade->id] = (recent_next[trade->id] + 1) % FEED_RECENT;
+    r->timestamp = trade->timestamp;
+    r->price = trade->price;
+    r->volume = trade->volume;
+    r->recv_us = trade->recv_us;
+    r->seen = bit;
+    return 0;
+}
+
+// Merge thread function
+// Releases the oldest held trade once every feed has moved more than the allowed lateness past
+// its timestamp, or once it has been held for merge_delay_ms, and drops copies. The output is
+// ordered as long as no trade arrives more than merge_delay_ms after a newer one it precedes;
+// later ones are passed on out of order and the aggregator treats them as late trades.
+static void* merge_thread(void* arg) {
+    (void)arg;
+    pthread_mutex_lock(&merge_lock);
+    while (heap_len > 0 || !destroy_flag) {
+        if (heap_len == 0) {
+            pthread_cond_wait(&merge_cond, &merge_lock);
+            continue;
+        }
+        long long deadline = heap[0].recv_us + merge_delay_ms * 1000;
+        if (!destroy_flag && heap[0].timestamp > merge_frontier() && rt_now_us() < deadline) {
+            struct timespec ts = {deadline / 1000000, (deadline % 1000000) * 1000};
+            pthread_cond_timedwait(&merge_cond, &merge_lock, &ts);
+            continue;
+        }
+
+        TradeData trade;
+        heap_pop(&trade);
+        if (is_duplicate(&trade)) {
+            feeds[trade.feed].duplicates++;
+            continue;
+        }
+        feeds[trade.feed].first++;
+        if (queue_push(&trade_queues[producer_of(trade.id)], &trade) != 0) {
+            metrics_add(METRIC_TRADES_DROPPED, 1);
+        }
+    }
+    pthread_mutex_unlock(&merge_lock);
+    return NULL;
+}
+
+// Replay thread function
+// Feeds the recorded messages through the same parser as the websocket. Lines written by
+// feed_record start with their receive time and are replayed at the recorded pace, scaled by
+// the speed; other lines are taken as bare messages.
+static void* replay_thread(void* arg) {
+    Feed *feed = arg;
+    int id = feed - feeds;
+    FILE *file = fopen(feed->path, "r");
+    if (!file) {
+        fprintf(stderr, "[Feed] Could not open %s\n", feed->path);
+    } else {
+        char *line = NULL;
+        size_t cap = 0;
+        ssize_t len;
+        long long first_recorded = -1, start_us = rt_now_us();
+        while (!destroy_flag && (len = getline(&line, &cap, file)) > 0) {
+            char *end;
+            long long recorded = strtoll(line, &end, 10);
+            char *msg = line;
+            if (end != line && *end == ' ') {
+                msg = end + 1;
+                if (first_recorded < 0) first_recorded = recorded;
+                if (feed->speed > 0) {
+                    long long due = start_us + (long long)((recorded - first_recorded) * 1000 / feed->speed);
+                    long long wait;
+                    while (!destroy_flag && (wait = due - rt_now_us()) > 0) usleep(wait > 100000 ? 100000 : wait);
+                }
+                // Trade-to-receive delays are those of the recording
+                feed->clock_offset = current_time_ms() - recorded;
+            }
+            handle_frame(id, msg, line + len - msg, rt_now_us());
+        }
+        free(line);
+        fclose(file);
+        printf("[Feed] Replay of %s finished, %llu trades\n", feed->path, feed->trades);
+    }
+
+    // The feed no longer holds back the merge
+    pthread_mutex_lock(&merge_lock);
+    feed->done = 1;
+    pthread_cond_signal(&merge_cond);
+    pthread_mutex_unlock(&merge_lock);
+    return NULL;
+}
+
+// Allocate the merge heap and the replay arenas and start the threads
+int feeds_start() {
+    if (num_feeds == 1) return 0;
+
+    heap_cap = config.queue_size;
+    heap = malloc(heap_cap * sizeof(TradeData));
+    if (!heap) return -1;
+    for (int i = 1; i < num_feeds; i++) {
+        if (arena_init(&feeds[i].replay_arena, config.arena_size) != 0) return -1;
+        feeds[i].arena = &feeds[i].replay_arena;
+    }
+
+    // Deadlines are taken from the monotonic receive times
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&merge_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_create(&merger, NULL, merge_thread, NULL);
+    for (int i = 1; i < num_feeds; i++) {
+        pthread_create(&feeds[i].thread, NULL, replay_thread, &feeds[i]);
+    }
+    return 0;
+}
+
+// Wait for the replay threads, then wake the merge thread
+void feeds_stop() {
+    if (num_feeds == 1) return;
+    // Replays check the destroy flag at least every 100 ms
+    for (int i = 1; i < num_feeds; i++) pthread_join(feeds[i].thread, NULL);
+    pthread_mutex_lock(&merge_lock);
+    pthread_cond_broadcast(&merge_cond);
+    pthread_mutex_unlock(&merge_lock);
+    pthread_join(merger, NULL);
+}
+
+// Hand a parsed trade on, through the merge when there is more than one feed
+int feed_trade(const TradeData *trade) {
+    if (num_feeds == 1) return queue_push(&trade_queues[producer_of(trade->id)], trade);
+
+    Feed *feed = &feeds[trade->feed];
+    pthread_mutex_lock(&merge_lock);
+    if (heap_len == heap_cap) {
+        pthread_mutex_unlock(&merge_lock);
+        return -1;
+    }
+    heap_push(trade);
+    if (trade->timestamp > feed->latest) feed->latest = trade->timestamp;
+    pthread_cond_signal(&merge_cond);
+    pthread_mutex_unlock(&merge_lock);
+    return 0;
+}
+
+// Parser allocations that did not fit into the arena of any feed, read while the feeds parse
+unsigned long long feeds_arena_overflows() {
+    unsigned long long overflows = 0;
+    for (int i = 0; i < num_feeds; i++) overflows += __atomic_load_n(&feeds[i].arena->overflows, __ATOMIC_RELAXED);
+    return overflows;
+}
+
+// Print the statistics of every feed
+void feeds_report(FILE *file) {
+    char name[128];
+    for (int i = 0; i < num_feeds; i++) {
+        Feed *feed = &feeds[i];
+        pthread_mutex_lock(&merge_lock);
+        unsigned long long first = feed->first, duplicates = feed->duplicates;
+        pthread_mutex_unlock(&merge_lock);
+        fprintf(file, "[Feeds] %s trades=%llu first=%llu duplicates=%llu\n",
+                feed->name, __atomic_load_n(&feed->trades, __ATOMIC_RELAXED), first, duplicates);
+        snprintf(name, sizeof(name), "[Feeds] %s behind first copy", feed->name);
+        hist_print(file, name, "us", &feed->lag);
+        snprintf(name, sizeof(name), "[Feeds] %s trade-to-receive", feed->name);
+        hist_print(file, name, "ms", &feed->delay);
+    }
+}
+
+// Append a received message to a recording
+void feed_record(FILE *file, const char *in, size_t len) {
+    fprintf(file, "%lld %.*s\n", current_time_ms(), (int)len, in);
+}
@@ -0,0 +1,64 @@
+#ifndef RTES_FEED_H
+#define RTES_FEED_H
+
+#include <stdio.h>
+#include <pthread.h>
+#include "rtes.h"
+
+// Sources of trades. Every feed parses its own messages into normalized TradeData; with more
+// than one feed the trades are merged by timestamp and duplicates are dropped before they reach
+// the producers, with a single feed they go to the producers directly.
+#define MAX_FEEDS 4
+#define FEED_WEBSOCKET 0    // the Finnhub websocket, always feed 0
+
+// Trades of a symbol remembered for deduplication
+#define FEED_RECENT 32
+
+typedef struct {
+    const char *name;
+    const char *path;           // recorded messages of a replay feed
+    double speed;               // replay speed, 0 replays as fast as possible
+    Arena *arena;               // messages of this feed are parsed here
+    Arena replay_arena;
+    pthread_t thread;
+    long long latest;           // newest trade timestamp, guarded by the merge lock
+    int done;                   // the feed sends no more trades
+    long long clock_offset;     // wall clock minus the recorded receive time of a replayed message, in ms
+    unsigned long long trades;      // trades parsed
+    unsigned long long first;       // trades this feed delivered first
+    unsigned long long duplicates;  // trades another feed had already delivered
+    Histogram lag;              // how far a duplicate arrived behind the first copy, in us
+    Histogram delay;            // trade timestamp to receipt, in ms
+} Feed;
+
+extern Feed feeds[MAX_FEEDS];
+extern int num_feeds;
+
+// How long the merge holds a trade back waiting for slower feeds, in ms
+extern long long merge_delay_ms;
+
+// Add a feed that replays recorded messages. Returns its index or -1 if there are too many feeds.
+int feed_add_replay(const char *path, double speed);
+
+// Allocate the merge heap and the replay arenas and start the merge and replay threads.
+// Call after the trade queues are set up. Returns 0 on success.
+int feeds_start();
+
+// Wait for the replay threads to notice the destroy flag, then wake the merge thread so it
+// flushes the held trades. Call after setting destroy_flag.
+void feeds_stop();
+
+// Hand a parsed trade of trade->feed on. Returns -1 if it had to be dropped.
+int feed_trade(const TradeData *trade);
+
+// Parser allocations that did not fit into the arena of any feed
+unsigned long long feeds_arena_overflows();
+
+// Per-feed trades, how often each feed was first and how far it was behind otherwise
+void feeds_report(FILE *file);
+
+// Append a received message to a recording that --replay can play back. The receive time
+// precedes the message, so the replay keeps the original pacing.
+void feed_record(FILE *file, const char *in, size_t len);
+
+#endif
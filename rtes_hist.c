@@ -0,0 +1,66 @@
+#include "rtes_hist.h"
+
+// Index of the bucket that holds value
+static int bucket_index(unsigned long long value) {
+    if (value < HIST_LINEAR) return (int)value;
+    int power = 63 - __builtin_clzll(value); // >= 3
+    int sub = (int)((value >> (power - 2)) & (HIST_SUB_BUCKETS - 1));
+    int index = HIST_LINEAR + (power - 3) * HIST_SUB_BUCKETS + sub;
+    return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+// Upper bound of bucket i
+unsigned long long hist_bucket_bound(int i) {
+    if (i < HIST_LINEAR) return (unsigned long long)i;
+    int power = (i - HIST_LINEAR) / HIST_SUB_BUCKETS + 3;
+    int sub = (i - HIST_LINEAR) % HIST_SUB_BUCKETS;
+    return ((unsigned long long)(HIST_SUB_BUCKETS + sub + 1) << (power - 2)) - 1;
+}
+
+// Record one value
+void hist_record(Histogram *hist, long long value) {
+    unsigned long long v = value < 0 ? 0 : (unsigned long long)value;
+    __atomic_fetch_add(&hist->counts[bucket_index(v)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, v, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+    while (v > max && !__atomic_compare_exchange_n(&hist->max, &max, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Copy the histogram into snapshot
+void hist_snapshot(const Histogram *hist, Histogram *snapshot) {
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        snapshot->counts[i] = __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+    }
+    snapshot->total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+    snapshot->sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+    snapshot->max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+}
+
+// Upper bound of the bucket that holds the q-th quantile
+unsigned long long hist_quantile(const Histogram *hist, double q) {
+    unsigned long long total = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) total += hist->counts[i];
+    if (total == 0) return 0;
+    unsigned long long rank = (unsigned long long)(q * (double)(total - 1)) + 1;
+    unsigned long long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= rank) {
+            unsigned long long bound = hist_bucket_bound(i);
+            return bound < hist->max ? bound : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+// Print a one line summary
+void hist_print(FILE *file, const char *name, const char *unit, const Histogram *hist) {
+    Histogram snap;
+    hist_snapshot(hist, &snap);
+    fprintf(file, "%s: n=%llu mean=%.1f%s p50=%llu%s p90=%llu%s p99=%llu%s p99.9=%llu%s max=%llu%s\n",
+            name, snap.total, snap.total ? (double)snap.sum / snap.total : 0.0, unit,
+            hist_quantile(&snap, 0.5), unit, hist_quantile(&snap, 0.9), unit,
+            hist_quantile(&snap, 0.99), unit, hist_quantile(&snap, 0.999), unit, snap.max, unit);
+}
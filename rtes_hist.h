@@ -0,0 +1,34 @@
+#ifndef RTES_HIST_H
+#define RTES_HIST_H
+
+#include <stdio.h>
+
+// Log-linear latency histogram: exact below 8, then four buckets per power of two.
+// Recording is a few relaxed atomic adds, so any thread may record without a lock.
+#define HIST_LINEAR 8
+#define HIST_SUB_BUCKETS 4
+#define HIST_BUCKETS (HIST_LINEAR + 30 * HIST_SUB_BUCKETS)
+
+typedef struct {
+    unsigned long long counts[HIST_BUCKETS];
+    unsigned long long total;
+    unsigned long long sum;
+    unsigned long long max;
+} Histogram;
+
+// Record one value, negative values are recorded as 0
+void hist_record(Histogram *hist, long long value);
+
+// Upper bound of the bucket that holds the q-th quantile (0 <= q <= 1)
+unsigned long long hist_quantile(const Histogram *hist, double q);
+
+// Copy the histogram into snapshot, which can then be read without races
+void hist_snapshot(const Histogram *hist, Histogram *snapshot);
+
+// Print count, mean, p50, p90, p99, p99.9 and max on one line
+void hist_print(FILE *file, const char *name, const char *unit, const Histogram *hist);
+
+// Upper bound of bucket i, used for cumulative exports
+unsigned long long hist_bucket_bound(int i);
+
+#endif
@@ -0,0 +1,508 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <jansson.h>
+#include "rtes.h"
+#include "rtes_metrics.h"
+#include "rtes_feed.h"
+#include "rtes_alert.h"
+#include "json_stream.h"
+
+RtesConfig config = {2000, 10000, 0, .queue_size = 4096, .arena_size = 1 << 20, .metrics_interval = 15,
+                      .dedup_window = 60000, .dedup_size = 1 << 17, .retention_interval = 3600,
+                      .shutdown_timeout = 5000};
+
+volatile int destroy_flag = 0; // destroy flag
+volatile int drained_flag = 0;
+
+// An array of SymbolData and their names
+SymbolData symbols[NUM_SYMBOLS];
+SymbolInfo symbol_info[NUM_SYMBOLS];
+const char *symbol_names[NUM_SYMBOLS] = {"AAPL", "GOOG", "MSFT"};
+
+FixedQueue trade_queues[NUM_THREADS];
+AggWorker agg_workers[MAX_AGG_WORKERS];
+Arena frame_arena;
+DedupSet dedup_sets[NUM_THREADS];
+
+// Bytes at the end of a trade file read to seed the dedup sets, about 3500 trades
+#define DEDUP_SEED_BYTES (256 * 1024)
+
+Histogram process_latency;
+Histogram wakeup_latency;
+Histogram emit_lag;
+
+// FUnction for the current time
+long long current_time_ms() {
+    struct timeval time_now;
+    gettimeofday(&time_now, NULL);
+    return (time_now.tv_sec * 1000LL + time_now.tv_usec / 1000); // current time in ms
+}
+
+// Producer thread function
+// Takes trades from its queue until it is closed, so no thread or memory is created per trade.
+// Only this producer handles the symbols it owns, so their hot state stays in its cache.
+void* producer_thread(void* arg) {
+    int id = *(int*)arg;
+    free(arg);
+    rt_apply_self(&config.rt, RT_ROLE_WRITER);
+    TradeData trade;
+    TradeData* data = &trade;
+    while (queue_pop(&trade_queues[id], data)) {
+        SymbolData *sym = &symbols[data->id];
+        const SymbolInfo *info = sym->info;
+
+        // Trades received again after a reconnect or a restart, or from two feeds, are dropped
+        if (dedup_check(&dedup_sets[id], data->id, data->timestamp, data->price, data->volume,
+                        data->conditions, data->frame)) {
+            metrics_add(METRIC_DUPLICATES, 1);
+            continue;
+        }
+
+        // The trade file is only written by this producer, its lock is only contended while the
+        // retention thread drops old trades
+        int written = add_trade_sample(&sym->trade_store, data->price, info->symbol, data->timestamp, data->volume);
+        if (written > 0) metrics_add(METRIC_BYTES_WRITTEN, written);
+
+        pthread_mutex_lock(&sym->lock);
+        int late = agg_add(&sym->agg, data->timestamp, data->price, data->volume);
+        sym->price = data->price;
+        sym->timestamp = data->timestamp;
+        sym->volume = data->volume;
+
+        // Hand the symbol to its worker when this trade closed a window or when no deadline is
+        // scheduled for it yet
+        if ((late > 0 || agg_ready(&sym->agg) || sym->idle) && !sym->notified) {
+            sym->notified = 1;
+            sym->notified_us = rt_now_us();
+            AggWorker *worker = &agg_workers[worker_of(data->id)];
+            pthread_mutex_lock(&worker->lock);
+            worker->pending[worker->num_pending++] = data->id;
+            pthread_cond_signal(&worker->cond);
+            pthread_mutex_unlock(&worker->lock);
+        }
+        pthread_mutex_unlock(&sym->lock);
+
+        hist_record(&process_latency, rt_now_us() - data->recv_us);
+        alert_trade(data->id, data->price, data->timestamp, data->recv_us);
+        if (late != 0) metrics_add(METRIC_LATE_TRADES, 1);
+        if (!config.quiet) {
+            printf("[%s producer] Added trade to %s%s\n", info->symbol, info->trade_file,
+                   late == 0 ? "" : late > 0 ? " (late, correction)" : " (late, dropped)");
+        }
+    }
+    return NULL;
+}
+
+// Finalize what is ready for a symbol and schedule the deadline of its oldest open window
+static void run_symbol(AggWorker *worker, SymbolData *data, long long now) {
+	int processed = process_trades(data, now);
+
+	pthread_mutex_lock(&data->lock);
+	data->wakeups++;
+	long long deadline = agg_deadline(&data->agg);
+	data->idle = deadline < 0;
+	if (data->idle) wheel_cancel(&worker->wheel, &data->timer);
+	else wheel_schedule(&worker->wheel, &data->timer, deadline);
+	if (!config.quiet) {
+		printf("[%s aggregator %d] Processed %d trades, watermark %lld, late %lld, dropped %lld\n", data->info->symbol,
+		       (int)(worker - agg_workers), processed, data->agg.watermark, data->agg.late_trades, data->agg.dropped_trades);
+	}
+	pthread_mutex_unlock(&data->lock);
+}
+
+// Aggregation worker thread function
+// Sleeps until a producer puts a symbol on the pending list or until the earliest deadline in the
+// wheel, so the number of wake-ups follows the windows that are finalized rather than the number
+// of symbols. Once the producers have drained their queues, the windows that are ready are
+// finalized a last time and the worker exits.
+void* aggregator_thread(void* arg) {
+	int id = *(int*)arg;
+	free(arg);
+	rt_apply_self(&config.rt, RT_ROLE_AGG);
+	AggWorker *worker = &agg_workers[id];
+	int batch[NUM_SYMBOLS];
+
+	pthread_mutex_lock(&worker->lock);
+	while (!drained_flag) {
+		if (worker->num_pending == 0) {
+			// The wheel is only changed by this thread, so it can be read under the worker's lock
+			long long next = wheel_next(&worker->wheel);
+			if (next < 0) {
+				pthread_cond_wait(&worker->cond, &worker->lock);
+				continue;
+			}
+			if (next > current_time_ms()) {
+				struct timespec ts = {next / 1000, (next % 1000) * 1000000L};
+				if (pthread_cond_timedwait(&worker->cond, &worker->lock, &ts) != ETIMEDOUT) continue;
+			}
+		}
+		int n = worker->num_pending;
+		memcpy(batch, worker->pending, n * sizeof(int));
+		worker->num_pending = 0;
+		worker->wakeups++;
+		pthread_mutex_unlock(&worker->lock);
+
+		// The symbols the producers reported, then those whose deadline has passed
+		long long now = current_time_ms();
+		for (int i = 0; i < n; i++) {
+			SymbolData *data = &symbols[batch[i]];
+			pthread_mutex_lock(&data->lock);
+			data->notified = 0;
+			hist_record(&wakeup_latency, rt_now_us() - data->notified_us);
+			pthread_mutex_unlock(&data->lock);
+			run_symbol(worker, data, now);
+		}
+		struct timespec woke;
+		clock_gettime(CLOCK_REALTIME, &woke);
+		long long woke_us = woke.tv_sec * 1000000LL + woke.tv_nsec / 1000;
+		WheelTimer *timer = wheel_advance(&worker->wheel, now);
+		while (timer) {
+			// run_symbol schedules the timer again, which reuses next
+			WheelTimer *following = timer->next;
+			hist_record(&wakeup_latency, woke_us - timer->expires * 1000);
+			run_symbol(worker, timer->data, now);
+			timer = following;
+		}
+
+		pthread_mutex_lock(&worker->lock);
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	for (int i = id; i < NUM_SYMBOLS; i += config.agg_workers) {
+		if (symbols[i].info) process_trades(&symbols[i], current_time_ms());
+	}
+	return NULL;
+}
+
+// Settle the number of aggregation workers
+void agg_workers_init() {
+	if (config.agg_workers < 1) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		config.agg_workers = cpus > 0 ? (int)cpus : 1;
+	}
+	if (config.agg_workers > MAX_AGG_WORKERS) config.agg_workers = MAX_AGG_WORKERS;
+	if (config.agg_workers > NUM_SYMBOLS) config.agg_workers = NUM_SYMBOLS;
+	long long now = current_time_ms();
+	for (int i = 0; i < config.agg_workers; i++) {
+		pthread_mutex_init(&agg_workers[i].lock, NULL);
+		pthread_cond_init(&agg_workers[i].cond, NULL);
+		wheel_init(&agg_workers[i].wheel, now);
+	}
+}
+
+// Wake every aggregation worker
+void agg_workers_wake() {
+	for (int i = 0; i < config.agg_workers; i++) {
+		pthread_mutex_lock(&agg_workers[i].lock);
+		pthread_cond_broadcast(&agg_workers[i].cond);
+		pthread_mutex_unlock(&agg_workers[i].lock);
+	}
+}
+
+// Frames parsed by all feeds, numbers the frames so dedup can tell twins within a frame from copies
+static unsigned long long frames_parsed = 0;
+
+// Parse a Finnhub message received from a feed and hand its trades on
+int handle_frame(int feed, const char *in, size_t len, long long recv_us) {
+    metrics_add(METRIC_FRAMES_RECEIVED, 1);
+    unsigned long long frame = __atomic_add_fetch(&frames_parsed, 1, __ATOMIC_RELAXED);
+    Feed *source = &feeds[feed];
+
+    // Parse the received message, Jansson allocates from the feed's arena
+    json_t *root;
+    json_error_t error;
+    arena_use(source->arena);
+    root = json_loadb(in, len, 0, &error);
+    if (!root) {
+        printf("Error: on line %d: %s\n", error.line, error.text);
+        metrics_add(METRIC_PARSE_ERRORS, 1);
+        arena_use(NULL);
+        arena_reset(source->arena);
+        return -1;
+    }
+
+    json_t *type = json_object_get(root, "type");
+    json_t *data = json_object_get(root, "data");
+    int ping = type && json_is_string(type) && strcmp(json_string_value(type), "ping") == 0;
+
+    // json_array_foreach skips data when it is missing or not an array
+    size_t index;
+    json_t *value;
+    int queued = 0;
+    long long now = current_time_ms() - source->clock_offset;
+    json_array_foreach(data, index, value) {
+        if (ping) break; // Finnhub keep-alive, carries no trades
+        const char *symbol = json_string_value(json_object_get(value, "s"));
+        if (!symbol) continue;
+        double price = json_number_value(json_object_get(value, "p"));
+        double volume = json_number_value(json_object_get(value, "v"));
+        long long timestamp = json_integer_value(json_object_get(value, "t"));
+        for (int i = 0; i < NUM_SYMBOLS; i++) {
+            if (strcmp(symbol_info[i].symbol, symbol) == 0) {
+                // Copy the trade into a queue slot for the producers
+                TradeData temp;
+                temp.id = i;
+                temp.feed = feed;
+                temp.conditions = 0;
+                json_t *condition;
+                size_t ci;
+                json_array_foreach(json_object_get(value, "c"), ci, condition) {
+                    temp.conditions = dedup_hash_condition(temp.conditions, json_string_value(condition));
+                }
+                temp.price = to_ticks(price, symbol_info[i].scale.price);
+                temp.volume = to_ticks(volume, symbol_info[i].scale.volume);
+                temp.timestamp = timestamp;
+                temp.recv_us = recv_us;
+                temp.frame = frame;
+                metrics_add_trades(i, 1);
+                __atomic_store_n(&source->trades, source->trades + 1, __ATOMIC_RELAXED);
+                hist_record(&source->delay, now - timestamp);
+                if (feed_trade(&temp) != 0) {
+                    metrics_add(METRIC_TRADES_DROPPED, 1);
+                    fprintf(stderr, "[Main Service] Trade queue full, dropped %s trade\n", symbol);
+                } else {
+                    queued++;
+                }
+                break;
+            }
+        }
+    }
+
+    json_decref(root);
+    arena_use(NULL);
+    arena_reset(source->arena);
+    return queued;
+}
+
+// Parse a --scale list
+int parse_scales(const char *list) {
+    char buf[BUFFER_SIZE];
+    snprintf(buf, sizeof(buf), "%s", list);
+    char *save;
+    for (char *tok = strtok_r(buf, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        char *value = eq ? eq + 1 : tok;
+        if (eq) *eq = '\0';
+        char *end;
+        StoreScale scale = {strtoll(value, &end, 10), DEFAULT_VOLUME_SCALE};
+        if (*end == ':') scale.volume = strtoll(end + 1, &end, 10);
+        if (*end != '\0' || scale.price < 1 || scale.volume < 1) return -1;
+
+        int found = 0;
+        for (int i = 0; i < NUM_SYMBOLS; i++) {
+            if (!eq || strcmp(symbol_names[i], tok) == 0) {
+                config.scales[i] = scale;
+                found = 1;
+            }
+        }
+        if (!found) return -1;
+    }
+    return 0;
+}
+
+// Convert a decimal price or volume to ticks
+long long to_ticks(double value, long long scale) {
+    double ticks = value * scale;
+    return (long long)(ticks < 0 ? ticks - 0.5 : ticks + 0.5);
+}
+
+// Allocate the dedup sets, each producer gets an equal share
+int dedup_sets_init() {
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (config.dedup_size < 0 ||
+            dedup_init(&dedup_sets[i], config.dedup_size / NUM_THREADS, config.dedup_window) != 0) return -1;
+    }
+    return 0;
+}
+
+// Remember the last trades of a trade file, so the trades received again after a restart are
+// recognized as duplicates
+static void seed_dedup(int id, SymbolData *data) {
+    DedupSet *set = &dedup_sets[producer_of(id)];
+    StoreFile *store = &data->trade_store;
+    if (!set->buckets || store->empty) return;
+
+    char *tail = malloc(DEDUP_SEED_BYTES + 1);
+    if (!tail) return;
+    long long start = store->tail > DEDUP_SEED_BYTES ? store->tail - DEDUP_SEED_BYTES : 0;
+    ssize_t len = pread(store->fd, tail, store->tail - start, start);
+    tail[len > 0 ? len : 0] = '\0';
+
+    // Records are flat objects, the first one may be cut off and is skipped
+    int seeded = 0;
+    char *record = tail;
+    while ((record = strstr(record, "{\"p\": ")) != NULL) {
+        char *end = strchr(record, '}');
+        if (!end) break;
+        long long price, timestamp, volume;
+        if (json_stream_get_ll(record, end - record + 1, "p", &price) == 0 &&
+            json_stream_get_ll(record, end - record + 1, "t", &timestamp) == 0 &&
+            json_stream_get_ll(record, end - record + 1, "v", &volume) == 0) {
+            dedup_seed(set, id, timestamp, price, volume);
+            seeded++;
+        }
+        record = end + 1;
+    }
+    free(tail);
+    printf("Main: Seeded the dedup set with %d %s trades\n", seeded, data->info->symbol);
+}
+
+// Initialize JSON files for each symbol
+// Missing files are created, existing ones are opened for appending
+void initialize_json(const char* symbol, SymbolData* data) {
+    int id = data - symbols;
+    SymbolInfo *info = &symbol_info[id];
+    info->scale = config.scales[id];
+    if (info->scale.price < 1) info->scale.price = DEFAULT_PRICE_SCALE;
+    if (info->scale.volume < 1) info->scale.volume = DEFAULT_VOLUME_SCALE;
+    snprintf(info->symbol, BUFFER_SIZE, "%s", symbol);
+    snprintf(info->trade_file, BUFFER_SIZE, "%s.json", symbol);
+    snprintf(info->cand_file, BUFFER_SIZE, "%s_cand.json", symbol);
+    snprintf(info->mov_file, BUFFER_SIZE, "%s_mov.json", symbol);
+    snprintf(info->hourly_file, BUFFER_SIZE, "%s_cand_1h.json", symbol);
+    data->info = info;
+    agg_init(&data->agg, config.lateness, config.idle_timeout, config.corrections);
+    pthread_mutex_init(&data->lock, NULL);
+    data->idle = 1;
+    data->timer.data = data;
+
+    if (store_open(&data->trade_store, info->trade_file, "trade", &info->scale) != 0 ||
+        store_open(&data->cand_store, info->cand_file, "candlestick", &info->scale) != 0 ||
+        store_open(&data->mov_store, info->mov_file, "moving_average", &info->scale) != 0) {
+        fprintf(stderr, "Main: Could not open the %s JSON files\n", symbol);
+        exit(1);
+    }
+    seed_dedup(id, data);
+    printf("Main: Initialized %s JSON files\n", symbol);
+}
+
+// Write the checkpoint of a clean shutdown: the data files are synced to the disk and their sizes
+// recorded in a new file that replaces the old one, so the checkpoint is either complete or absent
+int checkpoint_write(const char *path, long long now) {
+    char tmp[BUFFER_SIZE];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *file = fopen(tmp, "w");
+    if (!file) return -1;
+
+    int ret = 0;
+    fprintf(file, "{\n    \"type\": \"checkpoint\",\n    \"data\": [");
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        StoreFile *stores[] = {&symbols[i].trade_store, &symbols[i].cand_store, &symbols[i].mov_store};
+        const char *paths[] = {symbol_info[i].trade_file, symbol_info[i].cand_file, symbol_info[i].mov_file};
+        for (int j = 0; j < 3; j++) {
+            if (store_sync(stores[j]) != 0) ret = -1;
+            fprintf(file, "%s\n        {\"f\": \"%s\", \"n\": %lld, \"t\": %lld}", i || j ? "," : "",
+                    paths[j], store_size(stores[j]), now);
+        }
+    }
+    fprintf(file, "\n    ]\n}\n");
+    if (fflush(file) != 0 || fsync(fileno(file)) != 0) ret = -1;
+    if (fclose(file) != 0) ret = -1;
+    if (ret != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Compare the data files with the checkpoint of the last clean shutdown
+void checkpoint_check(const char *path) {
+    JsonStream stream;
+    if (json_stream_open(&stream, path) != 0) {
+        printf("[Checkpoint] No checkpoint of a clean shutdown, the ends of the data files were checked\n");
+        return;
+    }
+    int files = 0, unchanged = 0;
+    long long when = 0;
+    while (json_stream_next(&stream) == 1) {
+        char file[BUFFER_SIZE];
+        long long size;
+        if (json_stream_get_string(stream.object, stream.object_len, "f", file, sizeof(file)) != 0 ||
+            json_stream_get_ll(stream.object, stream.object_len, "n", &size) != 0) continue;
+        json_stream_get_ll(stream.object, stream.object_len, "t", &when);
+        files++;
+        for (int i = 0; i < NUM_SYMBOLS; i++) {
+            StoreFile *stores[] = {&symbols[i].trade_store, &symbols[i].cand_store, &symbols[i].mov_store};
+            const char *paths[] = {symbol_info[i].trade_file, symbol_info[i].cand_file, symbol_info[i].mov_file};
+            for (int j = 0; j < 3; j++) {
+                if (strcmp(paths[j], file) != 0) continue;
+                long long now = store_size(stores[j]);
+                if (now == size && !stores[j]->repaired) unchanged++;
+                else printf("[Checkpoint] %s changed since the checkpoint, %lld bytes, %lld then, %lld torn bytes dropped\n",
+                            file, now, size, stores[j]->repaired);
+            }
+        }
+    }
+    json_stream_close(&stream);
+    printf("[Checkpoint] Clean shutdown at %lld, %d of %d files unchanged since\n", when, unchanged, files);
+    // A run that ends without a new checkpoint is then recognized at the next start
+    unlink(path);
+}
+
+// Trades waiting in all producer queues
+void trade_queue_stats(size_t *depth, size_t *high_water, unsigned long long *dropped) {
+    *depth = 0;
+    *high_water = 0;
+    *dropped = 0;
+    for (int i = 0; i < NUM_THREADS; i++) {
+        FixedQueue *queue = &trade_queues[i];
+        pthread_mutex_lock(&queue->mutex);
+        *depth += queue->count;
+        if (queue->high_water > *high_water) *high_water = queue->high_water;
+        *dropped += queue->dropped;
+        pthread_mutex_unlock(&queue->mutex);
+    }
+}
+
+// Add trade sample to the JSON file (Producer)
+// Price and volume are written as ticks, the scale is in the header of the file
+int add_trade_sample(StoreFile *store, long long price, const char* symbol, long long timestamp, long long volume) {
+    char record[STORE_MAX_RECORD];
+    int len = snprintf(record, sizeof(record), "{\"p\": %lld, \"s\": \"%s\", \"t\": %lld, \"v\": %lld, \"d\": 0}",
+                       price, symbol, timestamp, volume);
+    if (len < 0 || len >= (int)sizeof(record)) return -1;
+    return store_append(store, record, len);
+}
+
+// Process trades (Consumer)
+// Finalizes the event-time windows that the watermark has passed and appends their candlesticks
+// and moving averages. Returns the number of trades in the emitted candlesticks.
+int process_trades(SymbolData *data, long long now) {
+    AggCandle candles[MAX_CANDLES];
+    char record[STORE_MAX_RECORD];
+    int processed = 0;
+    int n;
+
+    do {
+        pthread_mutex_lock(&data->lock);
+        n = agg_advance(&data->agg, now, candles, MAX_CANDLES);
+        pthread_mutex_unlock(&data->lock);
+
+        for (int i = 0; i < n; i++) {
+            AggCandle *c = &candles[i];
+            if (c->has_candle) { // Process candlestick data
+                int len = agg_format_candle(record, sizeof(record), c);
+                int written = store_append(&data->cand_store, record, len);
+                if (written > 0) metrics_add(METRIC_BYTES_WRITTEN, written);
+                metrics_add(METRIC_CANDLES_EMITTED, 1);
+                hist_record(&emit_lag, current_time_ms() - c->t);
+                if (!c->correction) processed += c->count;
+            }
+            alert_candle(data - symbols, c);
+
+            if (c->has_mov) { // Process moving average data
+                int len = agg_format_mov(record, sizeof(record), c, current_time_ms() - c->t);
+                int written = store_append(&data->mov_store, record, len);
+                if (written > 0) metrics_add(METRIC_BYTES_WRITTEN, written);
+            }
+        }
+    } while (n == MAX_CANDLES);
+
+    return processed;
+}
@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <jansson.h>
+#include <sys/resource.h>
+#include "rtes.h"
+#include "rtes_metrics.h"
+#include "rtes_feed.h"
+
+// Synthetic load for the real ingestion path. Finnhub trade messages are generated at a
+// configurable rate and handed to handle_frame, as the websocket callback does, so the parser, the
+// queues, the producers, the aggregation and the file writes run exactly as in rtes, without a
+// network. The rate follows a burst shape: a spike of burst_factor times the base rate that decays
+// with burst_decay, like the market open, repeated every burst_period seconds.
+
+#define MAX_BATCH 1000
+#define FRAME_SIZE (MAX_BATCH * 128 + 64)
+
+// Load options
+typedef struct {
+    int symbols;            // symbols trades are generated for
+    double rate;            // base rate in trades per second, over all symbols
+    int batch;              // trades per frame
+    int duration;           // seconds
+    double burst_factor;    // peak rate as a multiple of the base rate, 1 for a flat rate
+    double burst_decay;     // time constant of the spike in seconds
+    double burst_period;    // seconds between spikes, 0 for a single spike at the start
+    double volatility;      // standard deviation of the relative price change per trade
+    int report;             // seconds between progress lines
+    unsigned long long seed;
+    const char *dir;
+    int keep;               // keep the generated files
+} LoadOptions;
+
+static LoadOptions options = {3, 1000, 10, 60, 1, 30, 0, 0.0005, 5, 1, "/tmp", 0};
+
+// Price and the random state of every generated symbol
+static double prices[NUM_SYMBOLS];
+static char names[NUM_SYMBOLS][16];
+static unsigned long long rng;
+
+// xorshift64*, uniform in [0, 1)
+static double uniform() {
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return ((rng * 0x2545F4914F6CDD1DULL) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Standard normal variate with the Box-Muller transform
+static double normal() {
+    double u = uniform();
+    if (u < 1e-300) u = 1e-300;
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * uniform());
+}
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Offered rate at elapsed seconds into the run
+static double rate_at(double elapsed) {
+    if (options.burst_factor <= 1) return options.rate;
+    double since = options.burst_period > 0 ? fmod(elapsed, options.burst_period) : elapsed;
+    return options.rate * (1 + (options.burst_factor - 1) * exp(-since / options.burst_decay));
+}
+
+// Build a Finnhub trade message, every trade moves the price of a random symbol one step
+static int build_frame(char *frame, size_t size, int batch, long long t) {
+    int len = snprintf(frame, size, "{\"data\":[");
+    for (int i = 0; i < batch; i++) {
+        int s = (int)(uniform() * options.symbols);
+        prices[s] *= 1 + options.volatility * normal();
+        if (prices[s] < 0.01) prices[s] = 0.01;
+        // Volumes are mostly small lots with the occasional block trade
+        int volume = 1 + (int)(100 * -log(1 - uniform()));
+        len += snprintf(frame + len, size - len, "%s{\"c\":[\"1\"],\"p\":%.2f,\"s\":\"%s\",\"t\":%lld,\"v\":%d}",
+                        i ? "," : "", prices[s], names[s], t, volume);
+    }
+    len += snprintf(frame + len, size - len, "],\"type\":\"trade\"}");
+    return len;
+}
+
+// Trades appended to the trade files so far
+static unsigned long long stored_trades() {
+    unsigned long long stored = 0;
+    for (int i = 0; i < options.symbols; i++) stored += __atomic_load_n(&symbols[i].trade_store.records, __ATOMIC_RELAXED);
+    return stored;
+}
+
+// Receive-to-process latency since the previous snapshot
+static void latency_since(Histogram *previous, Histogram *interval) {
+    Histogram now;
+    hist_snapshot(&process_latency, &now);
+    *interval = now;
+    for (int i = 0; i < HIST_BUCKETS; i++) interval->counts[i] -= previous->counts[i];
+    interval->total -= previous->total;
+    interval->sum -= previous->sum;
+    *previous = now;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -s, --symbols N        symbols to trade, at most %d (default %d)\n"
+            "  -r, --rate TPS         base rate in trades per second over all symbols (default %.0f)\n"
+            "  -b, --batch N          trades per frame, at most %d (default %d)\n"
+            "  -t, --duration SECONDS length of the run (default %d)\n"
+            "      --burst X          peak rate of a spike as a multiple of the base rate (default 1, flat)\n"
+            "      --burst-decay S    time constant of the spike in seconds (default %.0f)\n"
+            "      --burst-period S   seconds between spikes, 0 for one spike at the start (default 0)\n"
+            "      --volatility X     standard deviation of the relative price step per trade (default %g)\n"
+            "      --seed N           seed of the random prices, volumes and symbols (default 1)\n"
+            "      --report SECONDS   seconds between progress lines (default %d)\n"
+            "  -d, --dir DIR          directory for the generated files (default /tmp)\n"
+            "      --keep             keep the generated files\n"
+            "  -q, --queue-size N     trades that can wait for each producer (default %d)\n"
+            "  -l, --lateness MS      allowed lateness (default %lld)\n"
+            "  -w, --workers N        aggregation worker threads, at most %d (default one per online CPU)\n",
+            name, NUM_SYMBOLS, options.symbols, options.rate, MAX_BATCH, options.batch, options.duration,
+            options.burst_decay, options.volatility, options.report, config.queue_size, config.lateness, MAX_AGG_WORKERS);
+}
+
+int main(int argc, char **argv) {
+    static struct option long_options[] = {
+        {"symbols", required_argument, 0, 's'},
+        {"rate", required_argument, 0, 'r'},
+        {"batch", required_argument, 0, 'b'},
+        {"duration", required_argument, 0, 't'},
+        {"burst", required_argument, 0, 'B'},
+        {"burst-decay", required_argument, 0, 'D'},
+        {"burst-period", required_argument, 0, 'P'},
+        {"volatility", required_argument, 0, 'V'},
+        {"seed", required_argument, 0, 'S'},
+        {"report", required_argument, 0, 'R'},
+        {"dir", required_argument, 0, 'd'},
+        {"keep", no_argument, 0, 'k'},
+        {"queue-size", required_argument, 0, 'q'},
+        {"lateness", required_argument, 0, 'l'},
+        {"workers", required_argument, 0, 'w'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    rt_config_init(&config.rt);
+    while ((opt = getopt_long(argc, argv, "s:r:b:t:d:q:l:w:h", long_options, NULL)) != -1) {
+        switch (opt) {
+            case 's': options.symbols = atoi(optarg); break;
+            case 'r': options.rate = atof(optarg); break;
+            case 'b': options.batch = atoi(optarg); break;
+            case 't': options.duration = atoi(optarg); break;
+            case 'B': options.burst_factor = atof(optarg); break;
+            case 'D': options.burst_decay = atof(optarg); break;
+            case 'P': options.burst_period = atof(optarg); break;
+            case 'V': options.volatility = atof(optarg); break;
+            case 'S': options.seed = strtoull(optarg, NULL, 10); break;
+            case 'R': options.report = atoi(optarg); break;
+            case 'd': options.dir = optarg; break;
+            case 'k': options.keep = 1; break;
+            case 'q': config.queue_size = atoi(optarg); break;
+            case 'l': config.lateness = atoll(optarg); break;
+            case 'w': config.agg_workers = atoi(optarg); break;
+            case 'h': usage(argv[0]); return 0;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (options.symbols < 1 || options.symbols > NUM_SYMBOLS || options.batch < 1 || options.batch > MAX_BATCH ||
+        options.rate <= 0 || options.duration < 1 || options.burst_decay <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.report < 1) options.report = 1;
+    rng = options.seed ? options.seed : 1;
+    config.quiet = 1;
+
+    // The real symbols first, generated names for the rest
+    for (int i = 0; i < options.symbols; i++) {
+        if (i < 3 && symbol_names[i]) snprintf(names[i], sizeof(names[i]), "%s", symbol_names[i]);
+        else snprintf(names[i], sizeof(names[i]), "SYM%03d", i);
+        symbol_names[i] = names[i];
+        prices[i] = 50 + 450 * uniform();
+    }
+
+    // Work in a scratch directory so the symbol files of a live instance are not touched
+    char origin[BUFFER_SIZE], workdir[BUFFER_SIZE];
+    if (!getcwd(origin, sizeof(origin))) snprintf(origin, sizeof(origin), "/");
+    snprintf(workdir, sizeof(workdir), "%s/rtes-loadgen-XXXXXX", options.dir);
+    if (!mkdtemp(workdir) || chdir(workdir) != 0) {
+        perror(workdir);
+        return 1;
+    }
+
+    // Same setup as rtes
+    for (int i = 0; i < NUM_THREADS; i++) {
+        if (config.queue_size < 1 || queue_init(&trade_queues[i], config.queue_size, sizeof(TradeData)) != 0) {
+            fprintf(stderr, "[Loadgen] Could not allocate the trade queues\n");
+            return 1;
+        }
+    }
+    if (arena_init(&frame_arena, config.arena_size) != 0 || dedup_sets_init() != 0) {
+        fprintf(stderr, "[Loadgen] Could not allocate the frame arena or the dedup sets\n");
+        return 1;
+    }
+    json_set_alloc_funcs(arena_malloc, arena_free);
+    metrics_init(options.symbols, symbol_names);
+    for (int i = 0; i < options.symbols; i++) {
+        initialize_json(symbol_names[i], &symbols[i]);
+    }
+    if (config.agg_workers > options.symbols) config.agg_workers = options.symbols;
+    agg_workers_init();
+
+    pthread_t producers[NUM_THREADS], aggregators[MAX_AGG_WORKERS];
+    for (int i = 0; i < NUM_THREADS; i++) {
+        int *id = malloc(sizeof(int));
+        *id = i;
+        rt_thread_create(&config.rt, RT_ROLE_WRITER, &producers[i], producer_thread, id);
+    }
+    for (int i = 0; i < config.agg_workers; i++) {
+        int *id = malloc(sizeof(int));
+        *id = i;
+        rt_thread_create(&config.rt, RT_ROLE_AGG, &aggregators[i], aggregator_thread, id);
+    }
+    printf("[Loadgen] %d symbols on %d aggregation workers, %.0f trades/s, %d trades per frame, burst x%.1f decaying over %.0f s, %d s in %s\n",
+           options.symbols, config.agg_workers, options.rate, options.batch, options.burst_factor, options.burst_decay,
+           options.duration, workdir);
+    fflush(stdout);
+
+    char *frame = malloc(FRAME_SIZE);
+    unsigned long long offered = 0, last_offered = 0, last_stored = 0;
+    long long start = now_ns();
+    long long next = start;             // send time of the next frame
+    long long next_report = start + options.report * 1000000000LL;
+    long long end = start + options.duration * 1000000000LL;
+    long long behind = 0;               // longest time the generator ran behind its schedule
+    Histogram previous = {0}, interval;
+
+    while (next < end) {
+        long long now = now_ns();
+        if (next > now) {
+            struct timespec ts = {next / 1000000000LL, next % 1000000000LL};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        } else if (now - next > behind) {
+            behind = now - next;
+        }
+
+        int len = build_frame(frame, FRAME_SIZE, options.batch, current_time_ms());
+        handle_frame(FEED_WEBSOCKET, frame, len, rt_now_us());
+        offered += options.batch;
+        next += (long long)(options.batch * 1e9 / rate_at((next - start) / 1e9));
+
+        now = now_ns();
+        if (now >= next_report) {
+            double seconds = (now - start) / 1e9;
+            double span = options.report + (now - next_report) / 1e9;
+            unsigned long long stored = stored_trades();
+            size_t depth, high_water;
+            unsigned long long dropped;
+            trade_queue_stats(&depth, &high_water, &dropped);
+            latency_since(&previous, &interval);
+            struct rusage usage;
+            getrusage(RUSAGE_SELF, &usage);
+            printf("[Loadgen] t=%.0fs offered=%.0f/s stored=%.0f/s queue=%zu dropped=%llu rss=%ld KB "
+                   "receive-to-process p50=%llu p99=%llu us\n",
+                   seconds, (offered - last_offered) / span, (stored - last_stored) / span, depth, dropped,
+                   usage.ru_maxrss, hist_quantile(&interval, 0.5), hist_quantile(&interval, 0.99));
+            fflush(stdout);
+            last_offered = offered;
+            last_stored = stored;
+            next_report += options.report * 1000000000LL;
+        }
+    }
+    long long generated = now_ns();
+
+    // Let the producers store what is queued, then stop the aggregation workers as rtes does
+    for (int i = 0; i < NUM_THREADS; i++) queue_close(&trade_queues[i]);
+    for (int i = 0; i < NUM_THREADS; i++) pthread_join(producers[i], NULL);
+    long long drained = now_ns();
+    drained_flag = 1;
+    agg_workers_wake();
+    for (int i = 0; i < config.agg_workers; i++) pthread_join(aggregators[i], NULL);
+
+    size_t depth, high_water;
+    unsigned long long dropped;
+    trade_queue_stats(&depth, &high_water, &dropped);
+    unsigned long long stored = stored_trades();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long long cpu_us = usage.ru_utime.tv_sec * 1000000LL + usage.ru_utime.tv_usec +
+                       usage.ru_stime.tv_sec * 1000000LL + usage.ru_stime.tv_usec;
+    double seconds = (generated - start) / 1e9;
+    printf("[Loadgen] offered %llu trades in %.1f s (%.0f/s), stored %llu, dropped %llu, duplicates %llu, "
+           "drained in %lld ms, generator behind schedule by at most %lld ms\n",
+           offered, seconds, offered / seconds, stored, dropped, metrics_total(METRIC_DUPLICATES),
+           (drained - generated) / 1000000, behind / 1000000);
+    printf("[Loadgen] CPU %lld ms (%.2f us/trade including generation), peak rss=%ld KB, queue high water=%zu/%d, "
+           "arena high water=%zu/%zu overflows=%llu\n",
+           cpu_us / 1000, offered ? (double)cpu_us / offered : 0.0, usage.ru_maxrss, high_water, config.queue_size,
+           frame_arena.high_water, frame_arena.size, frame_arena.overflows);
+    long long wakeups = 0;
+    for (int i = 0; i < config.agg_workers; i++) wakeups += agg_workers[i].wakeups;
+    printf("[Loadgen] %d aggregation workers woke up %lld times\n", config.agg_workers, wakeups);
+    hist_print(stdout, "[Loadgen] receive-to-process", "us", &process_latency);
+    hist_print(stdout, "[Loadgen] aggregation wake-up", "us", &wakeup_latency);
+    hist_print(stdout, "[Loadgen] candle emit lag", "ms", &emit_lag);
+    free(frame);
+
+    for (int i = 0; i < options.symbols; i++) {
+        store_close(&symbols[i].trade_store);
+        store_close(&symbols[i].cand_store);
+        store_close(&symbols[i].mov_store);
+        if (options.keep) continue;
+        unlink(symbol_info[i].trade_file);
+        unlink(symbol_info[i].cand_file);
+        unlink(symbol_info[i].mov_file);
+    }
+    if (!options.keep && chdir(origin) == 0) rmdir(workdir);
+    return dropped > 0 ? 2 : 0;
+}
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "rtes_metrics.h"
+
+// Counters of one thread
+typedef struct MetricsBlock {
+    unsigned long long counters[METRIC_NUM_COUNTERS];
+    unsigned long long *trades;     // parsed trades per symbol
+    struct MetricsBlock *next;
+} MetricsBlock;
+
+static const char *counter_names[METRIC_NUM_COUNTERS][2] = {
+    {"rtes_frames_received_total", "Websocket messages received"},
+    {"rtes_parse_errors_total", "Messages that could not be parsed"},
+    {"rtes_trades_dropped_total", "Trades dropped because the trade queue was full"},
+    {"rtes_late_trades_total", "Trades that arrived after their window was finalized or were rejected by the aggregator"},
+    {"rtes_bytes_written_total", "Bytes appended to the trade, candlestick and moving average files"},
+    {"rtes_candles_emitted_total", "Candlesticks written"},
+    {"rtes_reconnects_total", "Closed or failed websocket connections"},
+    {"rtes_wire_bytes_received_total", "Bytes received on the websocket's TCP connection, including TLS and framing"},
+    {"rtes_decoded_bytes_received_total", "Bytes of websocket message payload after decompression"},
+    {"rtes_service_cpu_microseconds_total", "CPU time of the websocket thread in TLS, decompression and framing, excluding parsing"},
+    {"rtes_duplicate_trades_total", "Trades dropped because the same trade was already stored"},
+    {"rtes_stalls_total", "Connections closed and reconnected because a ping went unanswered or no trades arrived during market hours"},
+    {"rtes_retention_reclaimed_bytes_total", "Bytes the data files shrank by when old records were dropped"},
+    {"rtes_retention_read_bytes_total", "Bytes read by the retention thread to find old records and compact them"},
+    {"rtes_retention_written_bytes_total", "Bytes written by the retention thread: hourly candlesticks, blanked and copied records"},
+    {"rtes_alerts_total", "Alerts written because a price, move or volume rule fired"},
+    {"rtes_fragmented_messages_total", "Websocket messages that arrived in more than one piece and were reassembled"},
+    {"rtes_message_fragments_total", "Pieces the fragmented websocket messages arrived in"},
+    {"rtes_oversize_messages_total", "Websocket messages skipped because they exceeded --max-message"},
+};
+
+static int metrics_num_symbols = 0;
+static const char **metrics_symbol_names = NULL;
+static MetricsBlock *blocks = NULL;
+static pthread_mutex_t blocks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread MetricsBlock *local_block = NULL;
+
+// Set the symbol names used as labels
+void metrics_init(int num_symbols, const char **symbol_names) {
+    metrics_num_symbols = num_symbols;
+    metrics_symbol_names = symbol_names;
+}
+
+// Block of the calling thread, registered on first use
+static MetricsBlock *thread_block() {
+    if (local_block) return local_block;
+    MetricsBlock *block = calloc(1, sizeof(MetricsBlock));
+    if (!block) return NULL;
+    block->trades = calloc(metrics_num_symbols > 0 ? metrics_num_symbols : 1, sizeof(unsigned long long));
+    pthread_mutex_lock(&blocks_mutex);
+    block->next = blocks;
+    blocks = block;
+    pthread_mutex_unlock(&blocks_mutex);
+    local_block = block;
+    return block;
+}
+
+// Add to a counter of the calling thread
+void metrics_add(int counter, unsigned long long n) {
+    MetricsBlock *block = thread_block();
+    if (!block) return;
+    // Only this thread writes the value, the store is atomic so readers never see a torn value
+    __atomic_store_n(&block->counters[counter], block->counters[counter] + n, __ATOMIC_RELAXED);
+}
+
+// Add to the parsed trades of a symbol on the calling thread
+void metrics_add_trades(int symbol, unsigned long long n) {
+    MetricsBlock *block = thread_block();
+    if (!block || symbol < 0 || symbol >= metrics_num_symbols) return;
+    __atomic_store_n(&block->trades[symbol], block->trades[symbol] + n, __ATOMIC_RELAXED);
+}
+
+// Sum of a counter over all threads
+unsigned long long metrics_total(int counter) {
+    unsigned long long total = 0;
+    pthread_mutex_lock(&blocks_mutex);
+    for (MetricsBlock *block = blocks; block; block = block->next) {
+        total += __atomic_load_n(&block->counters[counter], __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&blocks_mutex);
+    return total;
+}
+
+// Write one histogram with cumulative buckets at every power of two
+static void write_histogram(FILE *file, const MetricsHistogram *metric) {
+    Histogram snap;
+    hist_snapshot(metric->hist, &snap);
+    fprintf(file, "# HELP %s %s\n# TYPE %s histogram\n", metric->name, metric->help, metric->name);
+    unsigned long long cumulative = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        cumulative += snap.counts[i];
+        int boundary = i < HIST_LINEAR ? i == HIST_LINEAR - 1 : (i - HIST_LINEAR) % HIST_SUB_BUCKETS == HIST_SUB_BUCKETS - 1;
+        if (boundary) fprintf(file, "%s_bucket{le=\"%llu\"} %llu\n", metric->name, hist_bucket_bound(i), cumulative);
+    }
+    fprintf(file, "%s_bucket{le=\"+Inf\"} %llu\n", metric->name, snap.total);
+    fprintf(file, "%s_sum %llu\n%s_count %llu\n", metric->name, snap.sum, metric->name, snap.total);
+}
+
+// Write all metrics in the Prometheus text format
+int metrics_write_file(const char *path, const MetricsGauge *gauges, int num_gauges,
+                       const MetricsHistogram *hists, int num_hists) {
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE *file = fopen(tmp_path, "w");
+    if (!file) return -1;
+
+    unsigned long long totals[METRIC_NUM_COUNTERS] = {0};
+    unsigned long long trades[metrics_num_symbols > 0 ? metrics_num_symbols : 1];
+    memset(trades, 0, sizeof(trades));
+    pthread_mutex_lock(&blocks_mutex);
+    for (MetricsBlock *block = blocks; block; block = block->next) {
+        for (int i = 0; i < METRIC_NUM_COUNTERS; i++) {
+            totals[i] += __atomic_load_n(&block->counters[i], __ATOMIC_RELAXED);
+        }
+        for (int i = 0; i < metrics_num_symbols; i++) {
+            trades[i] += __atomic_load_n(&block->trades[i], __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&blocks_mutex);
+
+    for (int i = 0; i < METRIC_NUM_COUNTERS; i++) {
+        fprintf(file, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+                counter_names[i][0], counter_names[i][1], counter_names[i][0], counter_names[i][0], totals[i]);
+    }
+    fprintf(file, "# HELP rtes_trades_parsed_total Trades parsed per symbol\n# TYPE rtes_trades_parsed_total counter\n");
+    for (int i = 0; i < metrics_num_symbols; i++) {
+        fprintf(file, "rtes_trades_parsed_total{symbol=\"%s\"} %llu\n", metrics_symbol_names[i], trades[i]);
+    }
+    for (int i = 0; i < num_gauges; i++) {
+        fprintf(file, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n",
+                gauges[i].name, gauges[i].help, gauges[i].name, gauges[i].name, gauges[i].value);
+    }
+    for (int i = 0; i < num_hists; i++) {
+        write_histogram(file, &hists[i]);
+    }
+
+    int failed = ferror(file);
+    if (fclose(file) != 0 || failed) {
+        remove(tmp_path);
+        return -1;
+    }
+    return rename(tmp_path, path);
+}
@@ -0,0 +1,64 @@
+#ifndef RTES_METRICS_H
+#define RTES_METRICS_H
+
+#include "rtes_hist.h"
+
+// Counters kept per thread. Every thread only writes its own block, so counting is a plain
+// store without locks or atomic read-modify-write; blocks are summed when the metrics are written.
+enum {
+    METRIC_FRAMES_RECEIVED,
+    METRIC_PARSE_ERRORS,
+    METRIC_TRADES_DROPPED,
+    METRIC_LATE_TRADES,
+    METRIC_BYTES_WRITTEN,
+    METRIC_CANDLES_EMITTED,
+    METRIC_RECONNECTS,
+    METRIC_WIRE_BYTES,
+    METRIC_DECODED_BYTES,
+    METRIC_SERVICE_CPU_US,
+    METRIC_DUPLICATES,
+    METRIC_STALLS,
+    METRIC_RETENTION_RECLAIMED,
+    METRIC_RETENTION_READ,
+    METRIC_RETENTION_WRITTEN,
+    METRIC_ALERTS_FIRED,
+    METRIC_FRAGMENTED_MESSAGES,
+    METRIC_MESSAGE_FRAGMENTS,
+    METRIC_OVERSIZE_MESSAGES,
+    METRIC_NUM_COUNTERS
+};
+
+// A gauge sampled by the caller when the metrics are written
+typedef struct {
+    const char *name;
+    const char *help;
+    double value;
+} MetricsGauge;
+
+// A latency histogram, exported with cumulative buckets at every power of two
+typedef struct {
+    const char *name;
+    const char *help;
+    const Histogram *hist;
+} MetricsHistogram;
+
+// Set the symbol names used as labels of the per-symbol trade counter. Call once before any
+// thread counts.
+void metrics_init(int num_symbols, const char **symbol_names);
+
+// Add to a counter of the calling thread
+void metrics_add(int counter, unsigned long long n);
+
+// Add to the parsed trades of a symbol on the calling thread
+void metrics_add_trades(int symbol, unsigned long long n);
+
+// Sum of a counter over all threads
+unsigned long long metrics_total(int counter);
+
+// Write all counters, the given gauges and histograms in the Prometheus text format.
+// The file is written next to path and renamed over it, so readers never see a partial file.
+// Returns 0 on success.
+int metrics_write_file(const char *path, const MetricsGauge *gauges, int num_gauges,
+                       const MetricsHistogram *hists, int num_hists);
+
+#endif
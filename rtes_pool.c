@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include "rtes_pool.h"
+
+// Allocate the slots of a queue
+int queue_init(FixedQueue *queue, size_t capacity, size_t elem_size) {
+    memset(queue, 0, sizeof(FixedQueue));
+    queue->slots = malloc(capacity * elem_size);
+    if (!queue->slots) return -1;
+    queue->capacity = capacity;
+    queue->elem_size = elem_size;
+    pthread_mutex_init(&queue->mutex, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    return 0;
+}
+
+// Copy an element into the queue
+int queue_push(FixedQueue *queue, const void *elem) {
+    pthread_mutex_lock(&queue->mutex);
+    if (queue->closed || queue->count == queue->capacity) {
+        queue->dropped++;
+        pthread_mutex_unlock(&queue->mutex);
+        return -1;
+    }
+    memcpy(queue->slots + queue->tail * queue->elem_size, elem, queue->elem_size);
+    queue->tail = (queue->tail + 1) % queue->capacity;
+    queue->count++;
+    queue->pushed++;
+    if (queue->count > queue->high_water) queue->high_water = queue->count;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+    return 0;
+}
+
+// Copy the oldest element out of the queue
+int queue_pop(FixedQueue *queue, void *elem) {
+    pthread_mutex_lock(&queue->mutex);
+    while (queue->count == 0 && !queue->closed) {
+        pthread_cond_wait(&queue->not_empty, &queue->mutex);
+    }
+    if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->mutex);
+        return 0;
+    }
+    memcpy(elem, queue->slots + queue->head * queue->elem_size, queue->elem_size);
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    pthread_mutex_unlock(&queue->mutex);
+    return 1;
+}
+
+// Wake all waiting consumers
+void queue_close(FixedQueue *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->not_empty);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// Number of queued elements
+size_t queue_depth(FixedQueue *queue) {
+    pthread_mutex_lock(&queue->mutex);
+    size_t count = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return count;
+}
+
+// Arena selected on the calling thread
+static __thread Arena *current_arena = NULL;
+static unsigned long long heap_allocs = 0;
+
+// Allocate the memory of an arena
+int arena_init(Arena *arena, size_t size) {
+    memset(arena, 0, sizeof(Arena));
+    arena->base = malloc(size);
+    if (!arena->base) return -1;
+    arena->size = size;
+    return 0;
+}
+
+// Allocate from the arena
+void *arena_alloc(Arena *arena, size_t size) {
+    size_t offset = (arena->used + 15) & ~(size_t)15;
+    if (offset + size > arena->size) return NULL;
+    arena->used = offset + size;
+    if (arena->used > arena->high_water) arena->high_water = arena->used;
+    arena->allocs++;
+    return arena->base + offset;
+}
+
+// Release everything allocated from the arena
+void arena_reset(Arena *arena) {
+    arena->used = 0;
+}
+
+// Select the arena used by arena_malloc on the calling thread
+void arena_use(Arena *arena) {
+    current_arena = arena;
+}
+
+// malloc replacement for Jansson
+void *arena_malloc(size_t size) {
+    Arena *arena = current_arena;
+    if (arena) {
+        void *ptr = arena_alloc(arena, size);
+        if (ptr) return ptr;
+        __atomic_fetch_add(&arena->overflows, 1, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return malloc(size);
+}
+
+// free replacement for Jansson
+void arena_free(void *ptr) {
+    Arena *arena = current_arena;
+    if (arena && (char *)ptr >= arena->base && (char *)ptr < arena->base + arena->size) return;
+    free(ptr);
+}
+
+// Number of arena_malloc calls that fell back to the heap
+unsigned long long arena_heap_allocs() {
+    return __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+}
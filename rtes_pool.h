@@ -0,0 +1,69 @@
+#ifndef RTES_POOL_H
+#define RTES_POOL_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// Fixed-capacity queue of fixed-size elements. All slots are allocated once at startup,
+// pushing and popping only copies elements in and out of the slots.
+typedef struct {
+    char *slots;
+    size_t elem_size;
+    size_t capacity;
+    size_t head, tail, count;
+    int closed;
+    pthread_mutex_t mutex;
+    pthread_cond_t not_empty;
+    unsigned long long pushed;
+    unsigned long long dropped;     // pushes rejected because the queue was full
+    size_t high_water;              // largest number of queued elements seen
+} FixedQueue;
+
+// Allocate the slots of a queue. Returns 0 on success.
+int queue_init(FixedQueue *queue, size_t capacity, size_t elem_size);
+
+// Copy an element into the queue. Returns -1 without blocking if the queue is full or closed.
+int queue_push(FixedQueue *queue, const void *elem);
+
+// Copy the oldest element out of the queue, blocking while it is empty.
+// Returns 1 when an element was copied and 0 once the queue is closed and empty.
+int queue_pop(FixedQueue *queue, void *elem);
+
+// Wake all waiting consumers, they drain the remaining elements and then stop
+void queue_close(FixedQueue *queue);
+
+// Number of queued elements
+size_t queue_depth(FixedQueue *queue);
+
+// Bump allocator that is reset as a whole. Used as the Jansson allocator while a frame is
+// parsed, so parsing does not touch the heap once the arena is large enough.
+typedef struct {
+    char *base;
+    size_t size;
+    size_t used;
+    size_t high_water;
+    unsigned long long allocs;      // allocations served from the arena
+    unsigned long long overflows;   // allocations that did not fit and went to the heap, atomic
+} Arena;
+
+// Allocate the memory of an arena. Returns 0 on success.
+int arena_init(Arena *arena, size_t size);
+
+// Allocate from the arena, 16 byte aligned. Returns NULL if it does not fit.
+void *arena_alloc(Arena *arena, size_t size);
+
+// Release everything allocated from the arena
+void arena_reset(Arena *arena);
+
+// Select the arena used by arena_malloc on the calling thread, NULL selects the heap
+void arena_use(Arena *arena);
+
+// malloc/free replacements for Jansson. Allocations are taken from the arena of the calling
+// thread when one is selected and from the heap otherwise. Freeing arena memory is a no-op.
+void *arena_malloc(size_t size);
+void arena_free(void *ptr);
+
+// Number of arena_malloc calls that fell back to the heap, because no arena was selected or it was full
+unsigned long long arena_heap_allocs();
+
+#endif
@@ -0,0 +1,226 @@
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+#include "rtes_reduce.h"
+
+#if defined(__aarch64__)
+#include <arm_neon.h>
+#elif defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Allocate room for capacity trades
+int columns_init(TradeColumns *cols, size_t capacity) {
+    memset(cols, 0, sizeof(TradeColumns));
+    size_t bytes = (capacity * sizeof(long long) + 31) & ~(size_t)31;
+    cols->t = aligned_alloc(32, bytes);
+    cols->price = aligned_alloc(32, bytes);
+    cols->volume = aligned_alloc(32, bytes);
+    if (!cols->t || !cols->price || !cols->volume) {
+        columns_free(cols);
+        return -1;
+    }
+    cols->capacity = capacity;
+    return 0;
+}
+
+// Append a trade
+int columns_push(TradeColumns *cols, long long t, long long price, long long volume) {
+    if (cols->len == cols->capacity) return -1;
+    cols->t[cols->len] = t;
+    cols->price[cols->len] = price;
+    cols->volume[cols->len] = volume;
+    cols->len++;
+    return 0;
+}
+
+void columns_free(TradeColumns *cols) {
+    free(cols->t);
+    free(cols->price);
+    free(cols->volume);
+    memset(cols, 0, sizeof(TradeColumns));
+}
+
+static void reduce_empty(Reduction *out) {
+    memset(out, 0, sizeof(Reduction));
+    out->min = LLONG_MAX;
+    out->max = LLONG_MIN;
+}
+
+// Fold trades from..n into a partial result
+static void reduce_tail(const long long *price, const long long *volume, size_t from, size_t n, Reduction *out) {
+    for (size_t i = from; i < n; i++) {
+        if (price[i] < out->min) out->min = price[i];
+        if (price[i] > out->max) out->max = price[i];
+        out->sum += price[i];
+        out->volume += volume[i];
+        out->pv += price[i] * volume[i];
+    }
+    out->count = n;
+}
+
+// Plain loop, used as the reference and on CPUs without a vector kernel
+void reduce_scalar(const long long *price, const long long *volume, size_t n, Reduction *out) {
+    reduce_empty(out);
+    reduce_tail(price, volume, 0, n, out);
+}
+
+// Neither NEON nor AVX2 multiply 64 bit lanes, so the low 64 bits of a product are built from
+// three 32x32->64 bit multiplies: lo(a)*lo(b) + ((hi(a)*lo(b) + lo(a)*hi(b)) << 32)
+
+#if defined(__aarch64__)
+
+static inline int64x2_t mul_s64(int64x2_t a, int64x2_t b) {
+    uint64x2_t ua = vreinterpretq_u64_s64(a), ub = vreinterpretq_u64_s64(b);
+    uint32x2_t alo = vmovn_u64(ua), ahi = vshrn_n_u64(ua, 32);
+    uint32x2_t blo = vmovn_u64(ub), bhi = vshrn_n_u64(ub, 32);
+    uint64x2_t cross = vmlal_u32(vmull_u32(ahi, blo), alo, bhi);
+    return vreinterpretq_s64_u64(vaddq_u64(vmull_u32(alo, blo), vshlq_n_u64(cross, 32)));
+}
+
+// Two int64 lanes, two vectors per iteration
+static void reduce_neon(const long long *price, const long long *volume, size_t n, Reduction *out) {
+    reduce_empty(out);
+    const int64_t *p = (const int64_t *)price, *v = (const int64_t *)volume;
+    int64x2_t vmin = vdupq_n_s64(LLONG_MAX), vmax = vdupq_n_s64(LLONG_MIN);
+    int64x2_t sum = vdupq_n_s64(0), vol = sum, pv = sum;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int64x2_t p0 = vld1q_s64(p + i), p1 = vld1q_s64(p + i + 2);
+        int64x2_t v0 = vld1q_s64(v + i), v1 = vld1q_s64(v + i + 2);
+        vmin = vbslq_s64(vcltq_s64(p0, vmin), p0, vmin);
+        vmin = vbslq_s64(vcltq_s64(p1, vmin), p1, vmin);
+        vmax = vbslq_s64(vcgtq_s64(p0, vmax), p0, vmax);
+        vmax = vbslq_s64(vcgtq_s64(p1, vmax), p1, vmax);
+        sum = vaddq_s64(sum, vaddq_s64(p0, p1));
+        vol = vaddq_s64(vol, vaddq_s64(v0, v1));
+        pv = vaddq_s64(pv, vaddq_s64(mul_s64(p0, v0), mul_s64(p1, v1)));
+    }
+    long long a = vgetq_lane_s64(vmin, 0), b = vgetq_lane_s64(vmin, 1);
+    out->min = a < b ? a : b;
+    a = vgetq_lane_s64(vmax, 0), b = vgetq_lane_s64(vmax, 1);
+    out->max = a > b ? a : b;
+    out->sum = vaddvq_s64(sum);
+    out->volume = vaddvq_s64(vol);
+    out->pv = vaddvq_s64(pv);
+    reduce_tail(price, volume, i, n, out);
+}
+
+#elif defined(__x86_64__)
+
+// Signed 64 bit compares need SSE4.2, so this kernel is only called when the CPU has it
+__attribute__((target("sse4.2")))
+static inline __m128i mul_epi64_sse(__m128i a, __m128i b) {
+    __m128i cross = _mm_add_epi64(_mm_mul_epu32(_mm_srli_epi64(a, 32), b), _mm_mul_epu32(a, _mm_srli_epi64(b, 32)));
+    return _mm_add_epi64(_mm_mul_epu32(a, b), _mm_slli_epi64(cross, 32));
+}
+
+__attribute__((target("sse4.2")))
+static void reduce_sse42(const long long *price, const long long *volume, size_t n, Reduction *out) {
+    reduce_empty(out);
+    __m128i vmin = _mm_set1_epi64x(LLONG_MAX), vmax = _mm_set1_epi64x(LLONG_MIN);
+    __m128i sum = _mm_setzero_si128(), vol = sum, pv = sum;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i p0 = _mm_loadu_si128((const __m128i *)(price + i)), p1 = _mm_loadu_si128((const __m128i *)(price + i + 2));
+        __m128i v0 = _mm_loadu_si128((const __m128i *)(volume + i)), v1 = _mm_loadu_si128((const __m128i *)(volume + i + 2));
+        vmin = _mm_blendv_epi8(vmin, p0, _mm_cmpgt_epi64(vmin, p0));
+        vmin = _mm_blendv_epi8(vmin, p1, _mm_cmpgt_epi64(vmin, p1));
+        vmax = _mm_blendv_epi8(vmax, p0, _mm_cmpgt_epi64(p0, vmax));
+        vmax = _mm_blendv_epi8(vmax, p1, _mm_cmpgt_epi64(p1, vmax));
+        sum = _mm_add_epi64(sum, _mm_add_epi64(p0, p1));
+        vol = _mm_add_epi64(vol, _mm_add_epi64(v0, v1));
+        pv = _mm_add_epi64(pv, _mm_add_epi64(mul_epi64_sse(p0, v0), mul_epi64_sse(p1, v1)));
+    }
+    long long lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, vmin);
+    out->min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    _mm_storeu_si128((__m128i *)lanes, vmax);
+    out->max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    _mm_storeu_si128((__m128i *)lanes, sum);
+    out->sum = lanes[0] + lanes[1];
+    _mm_storeu_si128((__m128i *)lanes, vol);
+    out->volume = lanes[0] + lanes[1];
+    _mm_storeu_si128((__m128i *)lanes, pv);
+    out->pv = lanes[0] + lanes[1];
+    reduce_tail(price, volume, i, n, out);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i mul_epi64_avx2(__m256i a, __m256i b) {
+    __m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+                                     _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+    return _mm256_add_epi64(_mm256_mul_epu32(a, b), _mm256_slli_epi64(cross, 32));
+}
+
+// Four int64 lanes, compiled for AVX2 and only called when the CPU supports it
+__attribute__((target("avx2")))
+static void reduce_avx2(const long long *price, const long long *volume, size_t n, Reduction *out) {
+    reduce_empty(out);
+    __m256i vmin = _mm256_set1_epi64x(LLONG_MAX), vmax = _mm256_set1_epi64x(LLONG_MIN);
+    __m256i sum = _mm256_setzero_si256(), vol = sum, pv = sum;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i p0 = _mm256_loadu_si256((const __m256i *)(price + i));
+        __m256i p1 = _mm256_loadu_si256((const __m256i *)(price + i + 4));
+        __m256i v0 = _mm256_loadu_si256((const __m256i *)(volume + i));
+        __m256i v1 = _mm256_loadu_si256((const __m256i *)(volume + i + 4));
+        vmin = _mm256_blendv_epi8(vmin, p0, _mm256_cmpgt_epi64(vmin, p0));
+        vmin = _mm256_blendv_epi8(vmin, p1, _mm256_cmpgt_epi64(vmin, p1));
+        vmax = _mm256_blendv_epi8(vmax, p0, _mm256_cmpgt_epi64(p0, vmax));
+        vmax = _mm256_blendv_epi8(vmax, p1, _mm256_cmpgt_epi64(p1, vmax));
+        sum = _mm256_add_epi64(sum, _mm256_add_epi64(p0, p1));
+        vol = _mm256_add_epi64(vol, _mm256_add_epi64(v0, v1));
+        pv = _mm256_add_epi64(pv, _mm256_add_epi64(mul_epi64_avx2(p0, v0), mul_epi64_avx2(p1, v1)));
+    }
+    long long lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, vmin);
+    out->min = lanes[0];
+    for (int k = 1; k < 4; k++) if (lanes[k] < out->min) out->min = lanes[k];
+    _mm256_storeu_si256((__m256i *)lanes, vmax);
+    out->max = lanes[0];
+    for (int k = 1; k < 4; k++) if (lanes[k] > out->max) out->max = lanes[k];
+    _mm256_storeu_si256((__m256i *)lanes, sum);
+    out->sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i *)lanes, vol);
+    out->volume = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    _mm256_storeu_si256((__m256i *)lanes, pv);
+    out->pv = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    reduce_tail(price, volume, i, n, out);
+}
+
+#endif
+
+static ReduceFn best_fn = reduce_scalar;
+static const char *best_name = "scalar";
+static pthread_once_t best_once = PTHREAD_ONCE_INIT;
+
+static void select_best() {
+#if defined(__aarch64__)
+    // NEON is mandatory on aarch64
+    best_fn = reduce_neon;
+    best_name = "neon";
+#elif defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        best_fn = reduce_avx2;
+        best_name = "avx2";
+    } else if (__builtin_cpu_supports("sse4.2")) {
+        best_fn = reduce_sse42;
+        best_name = "sse4.2";
+    }
+#endif
+}
+
+// Fastest kernel for this CPU
+ReduceFn reduce_best(const char **name) {
+    pthread_once(&best_once, select_best);
+    if (name) *name = best_name;
+    return best_fn;
+}
+
+// Reduce with the kernel returned by reduce_best
+void reduce(const long long *price, const long long *volume, size_t n, Reduction *out) {
+    reduce_best(NULL)(price, volume, n, out);
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "rtes_retention.h"
+#include "rtes_metrics.h"
+#include "json_stream.h"
+
+// Bytes read at a time while looking for the cut
+#define SCAN_BLOCK (256 * 1024)
+
+// A minute candlestick read back for compaction
+typedef struct {
+    long long t, open, close, high, low, volume;
+    size_t seq;             // position in the file, a later correction of the same window wins
+} MinuteCandle;
+
+typedef struct {
+    MinuteCandle *items;
+    size_t len, cap;
+} MinuteCandles;
+
+// Hourly candlesticks, opened by the first pass
+static StoreFile hourly[NUM_SYMBOLS];
+static long long hourly_last[NUM_SYMBOLS];  // end of the newest hourly candlestick, -1 if none
+static int hourly_open = 0;
+
+// Only the retention thread scans, so the block buffer is shared
+static char scan_buf[SCAN_BLOCK + 1];
+
+typedef void (*RecordFn)(const char *record, size_t len, void *arg);
+
+// Offset of the first record at or after the start of the data array whose "t" is at least
+// keep_from, or end if all records before end are older. Records before the cut are passed to fn.
+static long long find_cut(StoreFile *store, long long keep_from, long long end, RecordFn fn, void *arg,
+                          unsigned long long *records, RetentionStats *stats) {
+    long long pos = store->data_start;
+    while (pos < end) {
+        size_t len = end - pos < SCAN_BLOCK ? (size_t)(end - pos) : SCAN_BLOCK;
+        ssize_t n = pread(store->fd, scan_buf, len, pos);
+        if (n <= 0) break;
+        stats->read += n;
+        size_t i = 0;
+        while (i < (size_t)n) {
+            // Records are flat objects, so every brace opens a record
+            char *open = memchr(scan_buf + i, '{', n - i);
+            if (!open) {
+                i = n;
+                break;
+            }
+            char *close = memchr(open, '}', scan_buf + n - open);
+            if (!close) break;
+            long long t;
+            size_t rlen = close - open + 1;
+            if (json_stream_get_ll(open, rlen, "t", &t) == 0 && t >= keep_from) return pos + (open - scan_buf);
+            if (fn) fn(open, rlen, arg);
+            (*records)++;
+            i = close - scan_buf + 1;
+        }
+        // A record cut off at the end of the block is read again with the next one
+        if (i == 0) break;
+        pos += i;
+    }
+    return end;
+}
+
+// "t" of the first record at or after offset, -1 if there is none before end. The front of a
+// file may be up to two blocks of whitespace left by earlier drops.
+static long long record_time_after(StoreFile *store, long long offset, long long end, RetentionStats *stats) {
+    char buf[2 * STORE_MAX_RECORD + 1];
+    while (offset < end) {
+        size_t len = end - offset < (long long)sizeof(buf) - 1 ? (size_t)(end - offset) : sizeof(buf) - 1;
+        ssize_t n = pread(store->fd, buf, len, offset);
+        if (n <= 0) return -1;
+        stats->read += n;
+        buf[n] = '\0';
+        char *open = strchr(buf, '{');
+        if (!open) {
+            offset += n;
+            continue;
+        }
+        char *close = strchr(open, '}');
+        long long t;
+        if (!close) {
+            // The record continues past the buffer, read it again from its start
+            if (open == buf) return -1;
+            offset += open - buf;
+            continue;
+        }
+        return json_stream_get_ll(open, close - open + 1, "t", &t) == 0 ? t : -1;
+    }
+    return -1;
+}
+
+// Drop the records in front of cut, returns whether they were dropped
+static int drop_front(StoreFile *store, const char *path, long long cut, RetentionStats *stats) {
+    StoreIo io = {0};
+    long long shrunk = store_drop_front(store, path, cut, &io);
+    if (shrunk < 0) {
+        fprintf(stderr, "[Retention] Could not drop old records of %s\n", path);
+        return 0;
+    }
+    stats->reclaimed += shrunk;
+    stats->read += io.read;
+    stats->written += io.written;
+    if (io.pause_us > stats->pause_us) stats->pause_us = io.pause_us;
+    if (io.copied) stats->copied = 1;
+    return io.dropped;
+}
+
+// Drop the trades of a symbol older than keep_from
+static void drop_trades(int id, long long keep_from, RetentionStats *stats) {
+    StoreFile *store = &symbols[id].trade_store;
+    unsigned long long records = 0;
+    long long cut = find_cut(store, keep_from, store_tail(store), NULL, NULL, &records, stats);
+    if (drop_front(store, symbol_info[id].trade_file, cut, stats)) stats->trades += records;
+}
+
+static void collect_candle(const char *record, size_t len, void *arg) {
+    MinuteCandles *list = arg;
+    MinuteCandle c;
+    if (json_stream_get_ll(record, len, "t", &c.t) != 0 || json_stream_get_ll(record, len, "open", &c.open) != 0 ||
+        json_stream_get_ll(record, len, "close", &c.close) != 0 || json_stream_get_ll(record, len, "high", &c.high) != 0 ||
+        json_stream_get_ll(record, len, "low", &c.low) != 0 || json_stream_get_ll(record, len, "v", &c.volume) != 0) {
+        return;
+    }
+    if (list->len == list->cap) {
+        size_t cap = list->cap ? list->cap * 2 : 1024;
+        MinuteCandle *items = realloc(list->items, cap * sizeof(MinuteCandle));
+        if (!items) return;
+        list->items = items;
+        list->cap = cap;
+    }
+    c.seq = list->len;
+    list->items[list->len++] = c;
+}
+
+static int candle_before(const void *a, const void *b) {
+    const MinuteCandle *x = a, *y = b;
+    if (x->t != y->t) return x->t < y->t ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+// Append the hourly candlesticks of the collected minute candlesticks. Hours up to the newest
+// hourly candlestick were already written before a restart and are skipped.
+static void write_hours(int id, MinuteCandles *list, RetentionStats *stats) {
+    qsort(list->items, list->len, sizeof(MinuteCandle), candle_before);
+    AggCandle hour;
+    int open = 0;
+    char record[STORE_MAX_RECORD];
+    for (size_t i = 0; i <= list->len; i++) {
+        const MinuteCandle *c = i < list->len ? &list->items[i] : NULL;
+        // A correction of a window replaces the candlestick written before it
+        if (c && i + 1 < list->len && list->items[i + 1].t == c->t) continue;
+        long long end = c ? ((c->t - AGG_WINDOW_MS) / RETENTION_HOUR_MS + 1) * RETENTION_HOUR_MS : -1;
+        if (open && (!c || end != hour.t)) {
+            int len = agg_format_candle(record, sizeof(record), &hour);
+            int written = store_append(&hourly[id], record, len);
+            if (written > 0) stats->written += written;
+            hourly_last[id] = hour.t;
+            stats->hours++;
+            open = 0;
+        }
+        if (!c || end <= hourly_last[id]) continue;
+        if (!open) {
+            memset(&hour, 0, sizeof(hour));
+            hour.t = end;
+            hour.open = c->open;
+            hour.high = c->high;
+            hour.low = c->low;
+            open = 1;
+        }
+        hour.close = c->close;
+        if (c->high > hour.high) hour.high = c->high;
+        if (c->low < hour.low) hour.low = c->low;
+        hour.volume += c->volume;
+    }
+}
+
+// Compact the minute candlesticks of a symbol whose window starts before cutoff, an hour
+// boundary, into hourly candlesticks, then drop them and the moving averages of the same windows
+static void compact_candles(int id, long long cutoff, RetentionStats *stats) {
+    SymbolData *data = &symbols[id];
+    const SymbolInfo *info = &symbol_info[id];
+    MinuteCandles list = {0};
+    unsigned long long records = 0, movs = 0;
+    long long keep_from = cutoff + AGG_WINDOW_MS;
+    long long cut = find_cut(&data->cand_store, keep_from, store_tail(&data->cand_store), collect_candle, &list,
+                             &records, stats);
+    // The hourly candlesticks are written first, so a crash in between loses no data
+    write_hours(id, &list, stats);
+    free(list.items);
+    if (drop_front(&data->cand_store, info->cand_file, cut, stats)) stats->candles += records;
+
+    cut = find_cut(&data->mov_store, keep_from, store_tail(&data->mov_store), NULL, NULL, &movs, stats);
+    drop_front(&data->mov_store, info->mov_file, cut, stats);
+}
+
+// Bytes taken by the files of all symbols
+static long long disk_usage() {
+    long long total = 0;
+    struct stat st;
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        StoreFile *files[] = {&symbols[i].trade_store, &symbols[i].cand_store, &symbols[i].mov_store, &hourly[i]};
+        for (int f = 0; f < 4; f++) {
+            if (files[f]->fd >= 0 && fstat(files[f]->fd, &st) == 0) total += st.st_size;
+        }
+    }
+    return total;
+}
+
+// Drop the oldest data until the files fit into the disk budget. Every symbol gives up the same
+// share of its records, so the symbols keep the same time span.
+static void enforce_budget(RetentionStats *stats) {
+    long long excess = disk_usage() - config.disk_budget;
+    if (excess <= 0) return;
+
+    long long raw = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++) raw += store_tail(&symbols[i].trade_store) - symbols[i].trade_store.data_start;
+    if (raw > 0) {
+        double share = excess < raw ? (double)excess / raw : 1.0;
+        for (int i = 0; i < NUM_SYMBOLS; i++) {
+            StoreFile *store = &symbols[i].trade_store;
+            long long end = store_tail(store);
+            long long t = record_time_after(store, store->data_start + (long long)((end - store->data_start) * share), end, stats);
+            drop_trades(i, t < 0 ? 0x3fffffffffffffffLL : t, stats);
+        }
+        excess = disk_usage() - config.disk_budget;
+        if (excess <= 0) return;
+    }
+
+    long long minute = 0;
+    for (int i = 0; i < NUM_SYMBOLS; i++) {
+        minute += store_tail(&symbols[i].cand_store) - symbols[i].cand_store.data_start;
+        minute += store_tail(&symbols[i].mov_store) - symbols[i].mov_store.data_start;
+    }
+    if (minute > 0) {
+        double share = excess < minute ? (double)excess / minute : 1.0;
+        for (int i = 0; i < NUM_SYMBOLS; i++) {
+            StoreFile *store = &symbols[i].cand_store;
+            long long end = store_tail(store);
+            long long t = record_time_after(store, store->data_start + (long long)((end - store->data_start) * share), end, stats);
+            // Whole hours are compacted, so the cutoff is the end of the hour of that window
+            long long cutoff = t < 0 ? 0x3fffffffffffffffLL - RETENTION_HOUR_MS :
+                               ((t - AGG_WINDOW_MS) / RETENTION_HOUR_MS + 1) * RETENTION_HOUR_MS;
+            compact_candles(i, cutoff, stats);
+        }
+        excess = disk_usage() - config.disk_budget;
+    }
+    if (excess > 0) {
+        fprintf(stderr, "[Retention] Still %lld KB over the disk budget after dropping the oldest records\n", excess / 1024);
+    }
+}
+
+// Newest "t" in the last records of a file, -1 if it has none
+static long long last_time(StoreFile *store) {
+    char buf[STORE_MAX_RECORD + 1];
+    long long end = store_tail(store);
+    long long start = end - STORE_MAX_RECORD > store->data_start ? end - STORE_MAX_RECORD : store->data_start;
+    ssize_t n = pread(store->fd, buf, end - start, start);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    char *open = strrchr(buf, '{');
+    long long t;
+    if (!open || json_stream_get_ll(open, buf + n - open, "t", &t) != 0) return -1;
+    return t;
+}
+
+// Run one pass over all symbols
+void retention_pass(long long now_ms, RetentionStats *stats) {
+    memset(stats, 0, sizeof(RetentionStats));
+    if (!hourly_open) {
+        for (int i = 0; i < NUM_SYMBOLS; i++) {
+            if (store_open(&hourly[i], symbol_info[i].hourly_file, "candlestick_1h", &symbol_info[i].scale) != 0) {
+                fprintf(stderr, "[Retention] Could not open %s\n", symbol_info[i].hourly_file);
+                hourly[i].fd = -1;
+            }
+            hourly_last[i] = hourly[i].fd >= 0 ? last_time(&hourly[i]) : -1;
+        }
+        hourly_open = 1;
+    }
+
+    // A stop request ends the pass after the symbol at hand, whose files are consistent by then
+    for (int i = 0; i < NUM_SYMBOLS && !destroy_flag; i++) {
+        if (config.keep_trades > 0) drop_trades(i, now_ms - config.keep_trades, stats);
+        if (config.keep_candles > 0 && hourly[i].fd >= 0) {
+            compact_candles(i, (now_ms - config.keep_candles) / RETENTION_HOUR_MS * RETENTION_HOUR_MS, stats);
+        }
+    }
+    if (config.disk_budget > 0 && !destroy_flag) enforce_budget(stats);
+
+    metrics_add(METRIC_RETENTION_RECLAIMED, stats->reclaimed);
+    metrics_add(METRIC_RETENTION_READ, stats->read);
+    metrics_add(METRIC_RETENTION_WRITTEN, stats->written);
+}
+
+// Retention thread function
+void* retention_thread(void* arg) {
+    (void)arg;
+    while (!destroy_flag) {
+        long long start = current_time_ms();
+        RetentionStats stats;
+        retention_pass(start, &stats);
+        printf("[Retention] Dropped %llu trades, compacted %llu candlesticks into %llu hourly ones, reclaimed %llu KB "
+               "(%s), read %llu KB, wrote %llu KB, appends blocked for at most %lld us, %lld KB on disk, took %lld ms\n",
+               stats.trades, stats.candles, stats.hours, stats.reclaimed / 1024,
+               stats.copied ? "copied" : "in place", stats.read / 1024, stats.written / 1024, stats.pause_us,
+               disk_usage() / 1024, current_time_ms() - start);
+
+        // Sleep in short steps so the program exits promptly
+        for (int i = 0; i < config.retention_interval && !destroy_flag; i++) sleep(1);
+    }
+    return NULL;
+}
@@ -0,0 +1,32 @@
+#ifndef RTES_RETENTION_H
+#define RTES_RETENTION_H
+
+#include "rtes.h"
+
+// One hour, the length of the compacted candlesticks
+#define RETENTION_HOUR_MS (60 * 60 * 1000LL)
+
+// Work done by a retention pass
+typedef struct {
+    unsigned long long reclaimed;   // bytes the files shrank by
+    unsigned long long read;        // bytes read to find the cuts and to compact
+    unsigned long long written;     // bytes written to hourly files, blanked or copied
+    unsigned long long trades;      // trade records dropped
+    unsigned long long candles;     // minute candlesticks compacted
+    unsigned long long hours;       // hourly candlesticks written
+    long long pause_us;             // longest time an append was blocked
+    int copied;                     // a file had to be copied, its filesystem can not collapse it
+} RetentionStats;
+
+// Tiered retention of the data files. Raw trades are kept for config.keep_trades ms, minute
+// candlesticks and moving averages for config.keep_candles ms; older candlesticks are compacted
+// into hourly candlesticks in <SYMBOL>_cand_1h.json before they are dropped. While all files
+// together exceed config.disk_budget, the oldest raw trades go first, then the oldest minute
+// candlesticks. Records are dropped from the front of the files while the producers and
+// consumers keep appending (see store_drop_front).
+void retention_pass(long long now_ms, RetentionStats *stats);
+
+// Run a pass at startup and then every config.retention_interval seconds until destroy_flag is set
+void* retention_thread(void* arg);
+
+#endif
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include "rtes_rt.h"
+
+const char *rt_role_names[RT_NUM_ROLES] = {"net", "writer", "agg"};
+
+// Leave every role unpinned on the default scheduler
+void rt_config_init(RtConfig *rt) {
+    for (int i = 0; i < RT_NUM_ROLES; i++) {
+        rt->cpu[i] = -1;
+        rt->priority[i] = 0;
+    }
+    rt->lock_memory = 0;
+}
+
+// Enable the default real-time layout
+void rt_config_default(RtConfig *rt) {
+    static const int cpus[RT_NUM_ROLES] = {0, 1, 2};
+    static const int priorities[RT_NUM_ROLES] = {80, 70, 60};
+    for (int i = 0; i < RT_NUM_ROLES; i++) {
+        rt->cpu[i] = cpus[i];
+        rt->priority[i] = priorities[i];
+    }
+    rt->lock_memory = 1;
+}
+
+// Parse a list such as "net=0,writer=1,agg=2"
+int rt_parse_roles(const char *spec, int values[RT_NUM_ROLES]) {
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%s", spec);
+    char *save;
+    for (char *tok = strtok_r(copy, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+        char *eq = strchr(tok, '=');
+        if (!eq) return -1;
+        *eq = '\0';
+        int role = -1;
+        for (int i = 0; i < RT_NUM_ROLES; i++) {
+            if (strcmp(tok, rt_role_names[i]) == 0) role = i;
+        }
+        if (role < 0) return -1;
+        values[role] = atoi(eq + 1);
+    }
+    return 0;
+}
+
+// Pin and prioritize the calling thread
+void rt_apply_self(const RtConfig *rt, int role) {
+    pthread_t self = pthread_self();
+    if (rt->cpu[role] >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(rt->cpu[role], &set);
+        int result = pthread_setaffinity_np(self, sizeof(set), &set);
+        if (result != 0) {
+            fprintf(stderr, "[RT] Could not pin %s thread to cpu %d: %s\n", rt_role_names[role], rt->cpu[role], strerror(result));
+        }
+    }
+    if (rt->priority[role] > 0) {
+        struct sched_param param = {.sched_priority = rt->priority[role]};
+        int result = pthread_setschedparam(self, SCHED_FIFO, &param);
+        if (result != 0) {
+            fprintf(stderr, "[RT] Could not set SCHED_FIFO %d for %s thread: %s\n", rt->priority[role], rt_role_names[role], strerror(result));
+        }
+    }
+}
+
+// Prepare attributes for a new thread of the given role
+int rt_thread_attr(const RtConfig *rt, int role, pthread_attr_t *attr) {
+    if (pthread_attr_init(attr) != 0) return -1;
+    pthread_attr_setstacksize(attr, RT_STACK_SIZE);
+    if (rt->cpu[role] >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(rt->cpu[role], &set);
+        pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+    }
+    if (rt->priority[role] > 0) {
+        struct sched_param param = {.sched_priority = rt->priority[role]};
+        pthread_attr_setinheritsched(attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(attr, SCHED_FIFO);
+        pthread_attr_setschedparam(attr, &param);
+    }
+    return 0;
+}
+
+// Start a thread of the given role
+int rt_thread_create(const RtConfig *rt, int role, pthread_t *thread, void *(*fn)(void *), void *arg) {
+    pthread_attr_t attr;
+    int result = rt_thread_attr(rt, role, &attr);
+    if (result != 0) return pthread_create(thread, NULL, fn, arg);
+    result = pthread_create(thread, &attr, fn, arg);
+    pthread_attr_destroy(&attr);
+    if (result == EPERM) {
+        // Not allowed to use SCHED_FIFO, fall back to the default scheduler with the same stack
+        fprintf(stderr, "[RT] Not permitted to start the %s thread with SCHED_FIFO, using the default scheduler\n",
+                rt_role_names[role]);
+        pthread_attr_init(&attr);
+        pthread_attr_setstacksize(&attr, RT_STACK_SIZE);
+        result = pthread_create(thread, &attr, fn, arg);
+        pthread_attr_destroy(&attr);
+    }
+    return result;
+}
+
+// Lock all current and future pages when enabled
+int rt_lock_memory(const RtConfig *rt) {
+    if (!rt->lock_memory) return 0;
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+        fprintf(stderr, "[RT] mlockall failed: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Monotonic time in microseconds
+long long rt_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// CPU time of the calling thread in microseconds
+long long rt_thread_cpu_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Bytes received on a TCP socket, from the kernel's TCP_INFO (Linux 4.1 and later)
+long long rt_socket_bytes_received(int fd) {
+    struct tcp_info tcp;
+    socklen_t len = sizeof(tcp);
+    memset(&tcp, 0, sizeof(tcp));
+    if (fd < 0 || getsockopt(fd, IPPROTO_TCP, TCP_INFO, &tcp, &len) != 0) return -1;
+    if (len < offsetof(struct tcp_info, tcpi_bytes_received) + sizeof(tcp.tcpi_bytes_received)) return -1;
+    return tcp.tcpi_bytes_received;
+}
@@ -0,0 +1,55 @@
+#ifndef RTES_RT_H
+#define RTES_RT_H
+
+#include <pthread.h>
+
+// Thread roles that can be pinned and prioritized
+enum { RT_ROLE_NET, RT_ROLE_WRITER, RT_ROLE_AGG, RT_NUM_ROLES };
+
+// Stack size of threads created with rt_thread_create, kept small so mlockall stays cheap
+#define RT_STACK_SIZE (256 * 1024)
+
+// Real-time configuration
+typedef struct {
+    int cpu[RT_NUM_ROLES];      // core of every role, -1 leaves it unpinned
+    int priority[RT_NUM_ROLES]; // SCHED_FIFO priority of every role, 0 keeps the default scheduler
+    int lock_memory;            // mlockall current and future pages
+} RtConfig;
+
+// Role names as used on the command line: net, writer, agg
+extern const char *rt_role_names[RT_NUM_ROLES];
+
+// Leave every role unpinned on the default scheduler
+void rt_config_init(RtConfig *rt);
+
+// Enable the default real-time layout: net=0, writer=1, agg=2 on SCHED_FIFO 80/70/60 with mlockall
+void rt_config_default(RtConfig *rt);
+
+// Parse a list such as "net=0,writer=1,agg=2" into values. Returns 0 on success.
+int rt_parse_roles(const char *spec, int values[RT_NUM_ROLES]);
+
+// Pin and prioritize the calling thread. Failures are reported and otherwise ignored.
+void rt_apply_self(const RtConfig *rt, int role);
+
+// Prepare attributes for a new thread of the given role. Returns 0 on success.
+int rt_thread_attr(const RtConfig *rt, int role, pthread_attr_t *attr);
+
+// Start a thread of the given role pinned and prioritized from its start, with a small stack.
+// Where SCHED_FIFO is not permitted it starts on the default scheduler. Returns 0 on success or
+// the error of pthread_create.
+int rt_thread_create(const RtConfig *rt, int role, pthread_t *thread, void *(*fn)(void *), void *arg);
+
+// Lock all current and future pages when enabled. Returns 0 on success.
+int rt_lock_memory(const RtConfig *rt);
+
+// Monotonic time in microseconds, used for latency measurements
+long long rt_now_us();
+
+// CPU time of the calling thread in microseconds
+long long rt_thread_cpu_us();
+
+// Bytes received on a TCP socket so far, including TLS and websocket framing. Returns -1 if the
+// kernel does not report them.
+long long rt_socket_bytes_received(int fd);
+
+#endif
@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "rtes_store.h"
+
+#define STORE_CLOSING "\n    ]\n}\n"
+#define STORE_INDENT "\n        "
+
+// Read the scale from the header of a file, returns -1 if it has none
+static int read_scale(int fd, StoreScale *scale) {
+    char buf[257];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    // The header is written before the data array, so a scale after it belongs to a record
+    char *data = strstr(buf, "\"data\"");
+    char *found = strstr(buf, "\"scale\"");
+    if (!found || (data && found > data)) return -1;
+    char *p = strstr(found, "\"p\":");
+    char *v = strstr(found, "\"v\":");
+    if (!p || !v) return -1;
+    scale->price = atoll(p + 4);
+    scale->volume = atoll(v + 4);
+    return scale->price > 0 && scale->volume > 0 ? 0 : -1;
+}
+
+// Offset right after the opening bracket of the data array, -1 if the header has none
+static long long read_data_start(int fd) {
+    char buf[257];
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    char *data = strstr(buf, "\"data\"");
+    char *bracket = data ? strchr(data, '[') : NULL;
+    return bracket ? bracket - buf + 1 : -1;
+}
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+// Open a data file, creating it when it is missing or empty
+int store_open(StoreFile *store, const char *path, const char *type, const StoreScale *scale) {
+    memset(store, 0, sizeof(StoreFile));
+    pthread_mutex_init(&store->lock, NULL);
+    store->fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (store->fd < 0) return -1;
+
+    off_t size = lseek(store->fd, 0, SEEK_END);
+    StoreScale found;
+    if (size > 0 && (read_scale(store->fd, &found) != 0 ||
+                     found.price != scale->price || found.volume != scale->volume)) {
+        // Keep the old file as it is and start a new one with the current scale
+        char moved[1024];
+        snprintf(moved, sizeof(moved), "%s.%lld", path, (long long)time(NULL));
+        store_close(store);
+        if (rename(path, moved) != 0) return -1;
+        fprintf(stderr, "[Store] %s is not in the configured scale, moved it to %s\n", path, moved);
+        store->fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (store->fd < 0) return -1;
+        size = 0;
+    }
+
+    if (size <= 0) {
+        char header[192];
+        int n = snprintf(header, sizeof(header),
+                         "{\n    \"type\": \"%s\",\n    \"scale\": {\"p\": %lld, \"v\": %lld},\n    \"data\": [",
+                         type, scale->price, scale->volume);
+        if (pwrite(store->fd, header, n, 0) != n || pwrite(store->fd, STORE_CLOSING, strlen(STORE_CLOSING), n) < 0) {
+            store_close(store);
+            return -1;
+        }
+        store->tail = store->data_start = n;
+        store->empty = 1;
+        return 0;
+    }
+
+    store->data_start = read_data_start(store->fd);
+    if (store->data_start < 0) {
+        fprintf(stderr, "[Store] %s has no data array\n", path);
+        store_close(store);
+        return -1;
+    }
+
+    // Find the end of the last complete record. A write cut short by a kill or a power loss leaves
+    // part of a record or of the closing brackets behind it, which is dropped. Records are flat
+    // objects ending in a value, so a '}' ends a record unless it follows ']' (it closes the file)
+    // or a separator (it is left over from brackets that were partly overwritten).
+    char buf[4096];
+    long long end = -1;
+    long long pos = size;
+    int closed = 0;         // a ']' was passed, the next '}' ends a record
+    long long brace = -1;   // a '}' that ends a record unless a ']' comes before it
+    while (end < 0 && pos > store->data_start) {
+        long long start = pos - (long long)sizeof(buf) > store->data_start ? pos - (long long)sizeof(buf) : store->data_start;
+        if (pread(store->fd, buf, pos - start, start) != pos - start) {
+            store_close(store);
+            return -1;
+        }
+        for (long long i = pos - start - 1; i >= 0 && end < 0; i--) {
+            char c = buf[i];
+            if (c == ' ' || c == '\n' || c == '\r' || c == '\t') continue;
+            if (brace >= 0) {
+                if (c == ']') closed = 1;
+                else if (c != ',' && c != '[' && c != '{') end = brace;
+                brace = -1;
+            } else if (c == '}') {
+                if (closed) end = start + i + 1;
+                else brace = start + i + 1;
+            }
+        }
+        pos = start;
+    }
+    if (end < 0) end = store->data_start;
+    store->empty = end == store->data_start;
+
+    // Anything but the closing brackets after the last record is the rest of a torn write
+    char trailer[sizeof(STORE_CLOSING)];
+    ssize_t n = pread(store->fd, trailer, sizeof(trailer), end);
+    if (size - end != (off_t)strlen(STORE_CLOSING) || n != (ssize_t)strlen(STORE_CLOSING) ||
+        memcmp(trailer, STORE_CLOSING, n) != 0) {
+        store->repaired = size - end;
+        fprintf(stderr, "[Store] %s did not end with a complete record, dropped %lld bytes after offset %lld\n",
+                path, store->repaired, end);
+    }
+
+    // New records start right after the last record (or the opening bracket)
+    store->tail = end;
+    if (pwrite(store->fd, STORE_CLOSING, strlen(STORE_CLOSING), store->tail) < 0 ||
+        ftruncate(store->fd, store->tail + strlen(STORE_CLOSING)) != 0) {
+        store_close(store);
+        return -1;
+    }
+    return 0;
+}
+
+// Append one record
+int store_append(StoreFile *store, const char *record, size_t len) {
+    char buf[STORE_MAX_RECORD + 32];
+    if (len > STORE_MAX_RECORD) return -1;
+
+    // Separator, record and the closing brackets go out in a single write
+    size_t n = 0;
+    buf[n++] = ',';
+    memcpy(buf + n, STORE_INDENT, strlen(STORE_INDENT));
+    n += strlen(STORE_INDENT);
+    memcpy(buf + n, record, len);
+    n += len;
+    size_t advance = n;
+    memcpy(buf + n, STORE_CLOSING, strlen(STORE_CLOSING));
+    n += strlen(STORE_CLOSING);
+
+    pthread_mutex_lock(&store->lock);
+    // Whether a separator is needed is only known under the lock, a retention pass may have
+    // dropped every record since
+    const char *out = buf;
+    if (store->empty) {
+        out++;
+        n--;
+        advance--;
+    }
+    if (pwrite(store->fd, out, n, store->tail) != (ssize_t)n) {
+        pthread_mutex_unlock(&store->lock);
+        return -1;
+    }
+    store->tail += advance;
+    store->empty = 0;
+    store->records++;
+    store->bytes += n;
+    pthread_mutex_unlock(&store->lock);
+    return (int)n;
+}
+
+long long store_tail(StoreFile *store) {
+    pthread_mutex_lock(&store->lock);
+    long long tail = store->tail;
+    pthread_mutex_unlock(&store->lock);
+    return tail;
+}
+
+// Copy the bytes [from, to) of one file to offset at of another
+static int copy_range(int src, long long from, long long to, int dst, long long at, StoreIo *io) {
+    char buf[64 * 1024];
+    while (from < to) {
+        size_t len = to - from < (long long)sizeof(buf) ? (size_t)(to - from) : sizeof(buf);
+        ssize_t n = pread(src, buf, len, from);
+        if (n <= 0 || pwrite(dst, buf, n, at) != n) return -1;
+        io->read += n;
+        io->written += n;
+        from += n;
+        at += n;
+    }
+    return 0;
+}
+
+// The byte at offset, or -1 past the end of the file
+static int byte_at(int fd, long long offset) {
+    unsigned char c;
+    return pread(fd, &c, 1, offset) == 1 ? c : -1;
+}
+
+// Drop the records in front of cut by writing the kept records into a new file and renaming it
+// over the old one. Only the records appended while copying are copied under the lock.
+static long long drop_by_copy(StoreFile *store, const char *path, long long cut, StoreIo *io) {
+    char tmp[1024];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    long long snapshot = store_tail(store);
+    long long at = store->data_start;
+    if (copy_range(store->fd, 0, at, fd, 0, io) != 0) goto fail;
+    int copied = cut < snapshot;
+    if (copied) {
+        // cut is the start of a record, which follows an indent in the old file as well
+        if (pwrite(fd, STORE_INDENT, strlen(STORE_INDENT), at) < 0) goto fail;
+        at += strlen(STORE_INDENT);
+        if (copy_range(store->fd, cut, snapshot, fd, at, io) != 0) goto fail;
+        at += snapshot - cut;
+    }
+
+    long long start = now_us();
+    pthread_mutex_lock(&store->lock);
+    long long from = snapshot;
+    // Without any record copied, the records appended meanwhile must not start with a separator
+    if (!copied && from < store->tail && byte_at(store->fd, from) == ',') from++;
+    if (copy_range(store->fd, from, store->tail, fd, at, io) != 0 ||
+        pwrite(fd, STORE_CLOSING, strlen(STORE_CLOSING), at + store->tail - from) < 0 ||
+        rename(tmp, path) != 0) {
+        pthread_mutex_unlock(&store->lock);
+        goto fail;
+    }
+    long long shrunk = store->tail - (at + store->tail - from);
+    at += store->tail - from;
+    close(store->fd);
+    store->fd = fd;
+    store->empty = at == store->data_start;
+    store->tail = at;
+    pthread_mutex_unlock(&store->lock);
+    long long pause = now_us() - start;
+    if (pause > io->pause_us) io->pause_us = pause;
+    io->written += strlen(STORE_CLOSING);
+    io->copied = 1;
+    io->dropped = 1;
+    return shrunk;
+
+fail:
+    close(fd);
+    unlink(tmp);
+    return -1;
+}
+
+// Drop the records in front of cut
+long long store_drop_front(StoreFile *store, const char *path, long long cut, StoreIo *io) {
+    long long start = store->data_start;
+    struct stat st;
+    if (cut <= start || fstat(store->fd, &st) != 0) return cut <= start ? 0 : -1;
+
+    // Only whole blocks can be collapsed, less than a block is only blanked and left for the next time
+    long long block = st.st_blksize > 0 ? st.st_blksize : 4096;
+    long long from = (start + block - 1) / block * block;
+    long long to = cut / block * block;
+    long long shrunk = to > from ? to - from : 0;
+
+    long long begin = now_us();
+    pthread_mutex_lock(&store->lock);
+    // A cut at the tail may have become a separator in front of a record appended since
+    int all = cut >= store->tail;
+    if (!all && byte_at(store->fd, cut) == ',') cut++;
+    if (shrunk > 0 && fallocate(store->fd, FALLOC_FL_COLLAPSE_RANGE, from, shrunk) != 0) {
+        int err = errno;
+        pthread_mutex_unlock(&store->lock);
+        if (err == EOPNOTSUPP || err == EINVAL) return drop_by_copy(store, path, cut, io);
+        return -1;
+    }
+    store->tail -= shrunk;
+    cut -= shrunk;
+
+    // What is left of the dropped records between the bracket and the cut becomes whitespace
+    char blank[4096];
+    memset(blank, ' ', sizeof(blank));
+    for (long long pos = start; pos < cut; pos += sizeof(blank)) {
+        size_t len = cut - pos < (long long)sizeof(blank) ? (size_t)(cut - pos) : sizeof(blank);
+        if (pwrite(store->fd, blank, len, pos) < 0) break;
+        io->written += len;
+    }
+    if (all) store->empty = 1;
+    io->dropped = 1;
+    pthread_mutex_unlock(&store->lock);
+    long long pause = now_us() - begin;
+    if (pause > io->pause_us) io->pause_us = pause;
+    return shrunk;
+}
+
+long long store_size(StoreFile *store) {
+    return store_tail(store) + strlen(STORE_CLOSING);
+}
+
+// Write the appended records through to the disk
+int store_sync(StoreFile *store) {
+    pthread_mutex_lock(&store->lock);
+    int ret = fdatasync(store->fd);
+    pthread_mutex_unlock(&store->lock);
+    return ret;
+}
+
+// Close the file
+void store_close(StoreFile *store) {
+    if (store->fd >= 0) close(store->fd);
+    store->fd = -1;
+}
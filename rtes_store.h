@@ -0,0 +1,72 @@
+#ifndef RTES_STORE_H
+#define RTES_STORE_H
+
+#include <stddef.h>
+#include <pthread.h>
+
+// Largest record that can be appended
+#define STORE_MAX_RECORD 512
+
+// Fixed-point scale of a file: a stored price of x ticks is x / price units, likewise for volumes
+typedef struct {
+    long long price;
+    long long volume;
+} StoreScale;
+
+// A {"type": ..., "scale": {"p": ..., "v": ...}, "data": [...]} file that records are appended to in place. Only the closing
+// brackets at the end of the file are rewritten, so an append costs one write regardless of
+// how large the file has grown, and the file stays valid JSON after every append.
+typedef struct {
+    int fd;
+    long long tail;             // offset where the next record (or the closing brackets) starts
+    long long data_start;       // offset right after the opening bracket of the data array
+    int empty;                  // the data array has no records yet
+    unsigned long long records; // records appended since the file was opened
+    unsigned long long bytes;   // bytes written since the file was opened
+    pthread_mutex_t lock;       // held by appends, and by store_drop_front while it moves the tail
+    long long repaired;         // bytes of a torn write that store_open dropped from the end
+} StoreFile;
+
+// Bytes read and written by store_drop_front, and how long it blocked appends
+typedef struct {
+    unsigned long long read;
+    unsigned long long written;
+    long long pause_us;         // longest time appends were blocked
+    int copied;                 // the filesystem could not collapse the file in place
+    int dropped;                // the records in front of the cut are gone
+} StoreIo;
+
+// Open a data file, creating it with the given type and scale when it is missing or empty.
+// An existing file without a scale (written with decimal values) or with a different scale is
+// renamed to path.<unix time> and a new file is started, so values of different scales are
+// never mixed in one file.
+// A file that does not end with a complete record and the closing brackets, because a write was
+// cut short, is cut back to its last complete record.
+// Returns 0 on success and -1 if the file can not be opened or is not a data file.
+int store_open(StoreFile *store, const char *path, const char *type, const StoreScale *scale);
+
+// Append one record, a complete JSON object. Returns the bytes written or -1 on failure.
+int store_append(StoreFile *store, const char *record, size_t len);
+
+// Offset where the next record will be appended, taken under the lock. The bytes before it are
+// not changed by appends, so they can be read while the writer keeps appending.
+long long store_tail(StoreFile *store);
+
+// Drop the records in front of offset cut, which must be the start of a record or the tail.
+// Whole filesystem blocks are removed in place with FALLOC_FL_COLLAPSE_RANGE and the rest of the
+// dropped bytes become whitespace, so appends are only blocked for the collapse and no record is
+// rewritten. Records within less than a block are only blanked, the file shrinks at a later drop. Where the filesystem can not collapse a file, the kept records are copied into a new
+// file that replaces the old one, and appends are only blocked for the records added meanwhile.
+// Returns the number of bytes the file shrank by, or -1 on failure.
+long long store_drop_front(StoreFile *store, const char *path, long long cut, StoreIo *io);
+
+// Size of the file, the records and the closing brackets
+long long store_size(StoreFile *store);
+
+// Write the appended records through to the disk. Returns 0 on success and -1 on failure.
+int store_sync(StoreFile *store);
+
+// Close the file
+void store_close(StoreFile *store);
+
+#endif
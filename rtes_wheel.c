@@ -0,0 +1,119 @@
+#include <stddef.h>
+#include <string.h>
+#include "rtes_wheel.h"
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define WHEEL_RANGE (1LL << (WHEEL_BITS * WHEEL_LEVELS))
+
+void wheel_init(TimerWheel *wheel, long long now) {
+    memset(wheel, 0, sizeof(TimerWheel));
+    wheel->now = now;
+}
+
+// Put a timer into the slot of the level that covers its distance from now. Timers due before
+// earliest are put into its slot: the next tick when scheduled, the current one when cascading.
+static void place(TimerWheel *wheel, WheelTimer *timer, long long earliest) {
+    long long at = timer->expires;
+    if (at < earliest) at = earliest;
+    if (at - wheel->now >= WHEEL_RANGE) at = wheel->now + WHEEL_RANGE - 1;
+    long long delta = at - wheel->now;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= 1LL << (WHEEL_BITS * (level + 1))) level++;
+    int slot = (at >> (WHEEL_BITS * level)) & WHEEL_MASK;
+
+    WheelTimer **head = &wheel->slots[level][slot];
+    timer->next = *head;
+    if (*head) (*head)->pprev = &timer->next;
+    *head = timer;
+    timer->pprev = head;
+    timer->slot = level * WHEEL_SLOTS + slot;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+static void unlink_timer(TimerWheel *wheel, WheelTimer *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) timer->next->pprev = timer->pprev;
+    int level = timer->slot / WHEEL_SLOTS, slot = timer->slot % WHEEL_SLOTS;
+    if (!wheel->slots[level][slot]) wheel->occupied[level] &= ~(1ULL << slot);
+    timer->next = NULL;
+    timer->pprev = NULL;
+}
+
+void wheel_schedule(TimerWheel *wheel, WheelTimer *timer, long long expires) {
+    if (timer->pprev) unlink_timer(wheel, timer);
+    else wheel->count++;
+    timer->expires = expires;
+    place(wheel, timer, wheel->now + 1);
+}
+
+void wheel_cancel(TimerWheel *wheel, WheelTimer *timer) {
+    if (!timer->pprev) return;
+    unlink_timer(wheel, timer);
+    wheel->count--;
+}
+
+// Spread the timers of the coarser slots that start at the current time over the finer levels,
+// the coarsest first so its timers are spread further down if they land in a slot due now
+static void cascade(TimerWheel *wheel) {
+    int top = 1;
+    while (top < WHEEL_LEVELS - 1 && ((wheel->now >> (WHEEL_BITS * top)) & WHEEL_MASK) == 0) top++;
+    for (int level = top; level >= 1; level--) {
+        int slot = (wheel->now >> (WHEEL_BITS * level)) & WHEEL_MASK;
+        WheelTimer *timer = wheel->slots[level][slot];
+        wheel->slots[level][slot] = NULL;
+        wheel->occupied[level] &= ~(1ULL << slot);
+        while (timer) {
+            WheelTimer *next = timer->next;
+            place(wheel, timer, wheel->now);
+            timer = next;
+        }
+    }
+}
+
+WheelTimer *wheel_advance(TimerWheel *wheel, long long now) {
+    WheelTimer *expired = NULL;
+    while (wheel->now < now) {
+        // The next tick with work: a level 0 slot with timers, or the next coarser slot
+        long long next = (wheel->now | WHEEL_MASK) + 1;
+        int current = wheel->now & WHEEL_MASK;
+        uint64_t ahead = current == WHEEL_MASK ? 0 : wheel->occupied[0] & (~0ULL << (current + 1));
+        if (ahead) next = (wheel->now & ~(long long)WHEEL_MASK) + __builtin_ctzll(ahead);
+        if (next > now) {
+            wheel->now = now;
+            break;
+        }
+
+        wheel->now = next;
+        if ((next & WHEEL_MASK) == 0) cascade(wheel);
+        int slot = next & WHEEL_MASK;
+        WheelTimer *timer = wheel->slots[0][slot];
+        wheel->slots[0][slot] = NULL;
+        wheel->occupied[0] &= ~(1ULL << slot);
+        while (timer) {
+            WheelTimer *following = timer->next;
+            timer->pprev = NULL;
+            timer->next = expired;
+            expired = timer;
+            wheel->count--;
+            timer = following;
+        }
+    }
+    return expired;
+}
+
+long long wheel_next(const TimerWheel *wheel) {
+    if (wheel->count == 0) return -1;
+    long long next = -1;
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t occupied = wheel->occupied[level];
+        if (!occupied) continue;
+        // Slots are reached in order after the current one, the current one last
+        int shift = WHEEL_BITS * level;
+        long long base = wheel->now >> shift;
+        int n = (base & WHEEL_MASK) + 1;
+        uint64_t rotated = n == WHEEL_SLOTS ? occupied : (occupied >> n) | (occupied << (WHEEL_SLOTS - n));
+        long long at = (base + __builtin_ctzll(rotated) + 1) << shift;
+        if (next < 0 || at < next) next = at;
+    }
+    return next;
+}
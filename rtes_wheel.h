@@ -0,0 +1,48 @@
+#ifndef RTES_WHEEL_H
+#define RTES_WHEEL_H
+
+#include <stdint.h>
+
+// Hierarchical timer wheel with a resolution of 1 ms. Level 0 has a slot for every ms of the next
+// 64 ms, every further level 64 times coarser slots; timers of a coarser slot are spread over the
+// finer levels when the wheel reaches it. Scheduling and cancelling are O(1), and advancing skips
+// empty slots, so the cost does not depend on how many timers are pending. Timers beyond the last
+// level (about 4.6 hours) are kept in its farthest slot until they come within range.
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+typedef struct WheelTimer {
+    long long expires;          // ms, the wheel fires the timer once it has advanced that far
+    struct WheelTimer *next;
+    struct WheelTimer **pprev;  // link pointing to this timer, NULL while it is not scheduled
+    int slot;                   // level * WHEEL_SLOTS + slot of the list it is in
+    void *data;
+} WheelTimer;
+
+typedef struct {
+    long long now;              // ms the wheel has advanced to
+    WheelTimer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint64_t occupied[WHEEL_LEVELS]; // bit per slot that holds timers
+    int count;                  // timers scheduled
+} TimerWheel;
+
+// Start an empty wheel at now (ms)
+void wheel_init(TimerWheel *wheel, long long now);
+
+// Schedule a timer, moving it if it is already scheduled. A time that has passed fires at the
+// next advance.
+void wheel_schedule(TimerWheel *wheel, WheelTimer *timer, long long expires);
+
+// Remove a timer if it is scheduled
+void wheel_cancel(TimerWheel *wheel, WheelTimer *timer);
+
+// Advance the wheel to now and return the timers that expired as a list linked through next,
+// or NULL. They are no longer scheduled.
+WheelTimer *wheel_advance(TimerWheel *wheel, long long now);
+
+// Time the wheel has to be advanced to next, when the earliest timer fires or when a coarser slot
+// has to be spread out. Never later than the earliest timer, -1 if no timer is scheduled.
+long long wheel_next(const TimerWheel *wheel);
+
+#endif